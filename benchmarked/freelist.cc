@@ -14,45 +14,237 @@
    limitations under the License.
 */
 
+#include "../ringbuf/freelist.h"
+#include "../ringbuf/memory_resource.h"
+#include "../ringbuf/ringbuf.h"
+#include "perf.h"
 
 #include <benchmark/benchmark.h>
 
+#include <atomic>
+#include <cstdlib>
+#include <memory_resource>
+#include <thread>
+#include <vector>
+
 namespace
 {
 
+/** a cache line worth of message */
+struct payload
+{
+    int64_t seq;
+    char data[56];
+};
+
+/**
+ * Each thread keeps a window of live objects, every iteration frees the
+ * oldest and allocates a new one. The window size is the benchmark argument,
+ * a window bigger than a magazine makes the freelist go through the shared stack.
+ * The perf counters of each thread are reported per allocation.
+ */
 struct MyFixture: benchmark::Fixture
 {
-    MyFixture(){}
+    static constexpr size_t MAX_THREADS = 16;
+    static constexpr size_t MAX_WINDOW = 1024;
+
+    using pool_t = ufw::freelist<payload>;
+
+    MyFixture(): pool(MAX_THREADS * (MAX_WINDOW + 2 * 32)) {}
 
     ~MyFixture(){}
+
+    template <class Alloc, class Free>
+    static void run(benchmark::State& state, Alloc&& alloc, Free&& free)
+    {
+        std::vector<payload*> window(state.range(0));
+        for (auto& x: window)
+            x = alloc();
+
+        ufw::perf_counters perf;
+        perf.start();
+
+        size_t items = 0;
+        size_t pos = 0;
+        while (state.KeepRunning())
+        {
+            free(window[pos]);
+            benchmark::DoNotOptimize(window[pos] = alloc());
+            window[pos]->seq = items++;
+            pos = pos + 1 == window.size() ? 0 : pos + 1;
+        }
+
+        perf.stop();
+        ufw::report(state, perf.read(), items);
+
+        for (auto& x: window)
+            free(x);
+
+        state.SetBytesProcessed(items * sizeof(payload));
+        state.SetItemsProcessed(items);
+    }
+
+    template <class Resource>
+    static void run(benchmark::State& state, Resource& resource)
+    {
+        run(state,
+            [&] { return static_cast<payload*>(resource.allocate(sizeof(payload), alignof(payload))); },
+            [&](payload* x) { resource.deallocate(x, sizeof(payload), alignof(payload)); });
+    }
+
+    /**
+     * The benchmark thread allocates and hands every object over an SPSC ringbuf
+     * to a peer thread that frees it, free is only called on the peer.
+     * The perf counters are the allocating thread's, per allocation.
+     */
+    template <class Alloc, class Free>
+    static void handoff(benchmark::State& state, Alloc&& alloc, Free&& free)
+    {
+        auto ring = std::make_unique<ufw::ringbuf<payload*, 1024>>();
+        std::atomic<bool> stop {false};
+        std::thread peer([&]
+        {
+            for (;;)
+            {
+                if (!ring->take([&](payload* x) noexcept { free(x); }))
+                {
+                    if (stop.load(std::memory_order_acquire) && !ring->take([&](payload* x) noexcept { free(x); }))
+                        break;
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        ufw::perf_counters perf;
+        perf.start();
+
+        size_t items = 0;
+        while (state.KeepRunning())
+        {
+            payload* x;
+            while (!(x = alloc())) // all the blocks in flight
+                std::this_thread::yield();
+            x->seq = items++;
+            while (!ring->put(x))
+                std::this_thread::yield();
+        }
+
+        perf.stop();
+        stop.store(true, std::memory_order_release);
+        peer.join();
+        ufw::report(state, perf.read(), items);
+
+        state.SetBytesProcessed(items * sizeof(payload));
+        state.SetItemsProcessed(items);
+    }
+
+    template <class Resource>
+    static void handoff(benchmark::State& state, Resource& resource)
+    {
+        handoff(state,
+            [&] { return static_cast<payload*>(resource.allocate(sizeof(payload), alignof(payload))); },
+            [&](payload* x) { resource.deallocate(x, sizeof(payload), alignof(payload)); });
+    }
+
+    pool_t pool;
+    ufw::pool_resource pool_resource;
+    std::pmr::synchronized_pool_resource std_pool_resource;
 };
 
-//void benchme(benchmark::State& state) { ... }
-// BENCHMARK(benchme)->ThreadRange(1, 16);
+BENCHMARK_DEFINE_F(MyFixture, freelist)(benchmark::State& state)
+{
+    pool_t::cache cache(pool);
+    run(state, [&] { return cache.make(); }, [&](payload* x) { cache.destroy(x); });
+}
 
-BENCHMARK_DEFINE_F(MyFixture, benchme)(benchmark::State& state)
+BENCHMARK_DEFINE_F(MyFixture, new_delete)(benchmark::State& state)
 {
-    if (state.thread_index == 0) { /* set-up */ }
+    run(state, [] { return new payload(); }, [](payload* x) { delete x; });
+}
 
-    std::string x = "hello";
-    size_t bytes = 0;
-    size_t items = 0;
+BENCHMARK_DEFINE_F(MyFixture, malloc_free)(benchmark::State& state)
+{
+    run(state, [] { return static_cast<payload*>(std::malloc(sizeof(payload))); }, [](payload* x) { std::free(x); });
+}
+
+BENCHMARK_DEFINE_F(MyFixture, pmr_pool)(benchmark::State& state)
+{
+    run(state, pool_resource);
+}
+
+BENCHMARK_DEFINE_F(MyFixture, pmr_local_pool)(benchmark::State& state)
+{
+    run(state, ufw::this_thread_resource());
+}
+
+BENCHMARK_DEFINE_F(MyFixture, pmr_std_pool)(benchmark::State& state)
+{
+    run(state, std_pool_resource);
+}
 
+/** the peer's cache returns the blocks a magazine at a time through the shared stack */
+BENCHMARK_DEFINE_F(MyFixture, freelist_handoff)(benchmark::State& state)
+{
+    pool_t::cache cache(pool);
+    pool_t::cache peer_cache(pool); // only used by the peer
+    handoff(state, [&] { return cache.make(); }, [&](payload* x) { peer_cache.destroy(x); });
+}
+
+BENCHMARK_DEFINE_F(MyFixture, new_delete_handoff)(benchmark::State& state)
+{
+    handoff(state, [] { return new payload(); }, [](payload* x) { delete x; });
+}
+
+BENCHMARK_DEFINE_F(MyFixture, pmr_pool_handoff)(benchmark::State& state)
+{
+    handoff(state, pool_resource);
+}
+
+BENCHMARK_DEFINE_F(MyFixture, pmr_std_pool_handoff)(benchmark::State& state)
+{
+    handoff(state, std_pool_resource);
+}
+
+/** a batch of window allocations, then the arena is reset */
+BENCHMARK_DEFINE_F(MyFixture, pmr_arena)(benchmark::State& state)
+{
+    size_t const batch = state.range(0);
+    ufw::arena_resource arena(batch * sizeof(payload));
+
+    ufw::perf_counters perf;
+    perf.start();
+
+    size_t items = 0;
     while (state.KeepRunning())
     {
-        benchmark::DoNotOptimize(bytes += std::string(x).size());
-        ++items;
+        auto* x = static_cast<payload*>(arena.allocate(sizeof(payload), alignof(payload)));
+        benchmark::DoNotOptimize(x);
+        x->seq = items;
+        if (++items % batch == 0)
+            arena.reset();
     }
 
-    state.SetBytesProcessed(bytes);
-    state.SetItemsProcessed(items);
+    perf.stop();
+    ufw::report(state, perf.read(), items);
 
-    if (state.thread_index == 0) { /* tear-down */ }
+    state.SetBytesProcessed(items * sizeof(payload));
+    state.SetItemsProcessed(items);
 }
 
-BENCHMARK_REGISTER_F(MyFixture, benchme)->ThreadRange(1, 16);
+BENCHMARK_REGISTER_F(MyFixture, freelist)->Arg(16)->Arg(MyFixture::MAX_WINDOW)->ThreadRange(1, 16);
+BENCHMARK_REGISTER_F(MyFixture, new_delete)->Arg(16)->Arg(MyFixture::MAX_WINDOW)->ThreadRange(1, 16);
+BENCHMARK_REGISTER_F(MyFixture, malloc_free)->Arg(16)->Arg(MyFixture::MAX_WINDOW)->ThreadRange(1, 16);
+BENCHMARK_REGISTER_F(MyFixture, pmr_pool)->Arg(16)->Arg(MyFixture::MAX_WINDOW)->ThreadRange(1, 16);
+BENCHMARK_REGISTER_F(MyFixture, pmr_local_pool)->Arg(16)->Arg(MyFixture::MAX_WINDOW)->ThreadRange(1, 16);
+BENCHMARK_REGISTER_F(MyFixture, pmr_std_pool)->Arg(16)->Arg(MyFixture::MAX_WINDOW)->ThreadRange(1, 16);
+BENCHMARK_REGISTER_F(MyFixture, pmr_arena)->Arg(16)->Arg(MyFixture::MAX_WINDOW)->ThreadRange(1, 16);
 
-} // local namespace
+// this_thread_resource() is left out, its blocks must be freed by the allocating thread
+BENCHMARK_REGISTER_F(MyFixture, freelist_handoff)->UseRealTime();
+BENCHMARK_REGISTER_F(MyFixture, new_delete_handoff)->UseRealTime();
+BENCHMARK_REGISTER_F(MyFixture, pmr_pool_handoff)->UseRealTime();
+BENCHMARK_REGISTER_F(MyFixture, pmr_std_pool_handoff)->UseRealTime();
 
-BENCHMARK_MAIN()
+} // local namespace
 
+BENCHMARK_MAIN();
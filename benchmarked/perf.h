@@ -0,0 +1,60 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "../ringbuf/perf_counters.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <string>
+
+namespace ufw {
+
+/** adds the counts of b to a, same mode samples */
+inline void accumulate(perf_counters::sample& a, perf_counters::sample const& b) noexcept
+{
+    if (!a.size)
+    {
+        a = b;
+        return;
+    }
+    for (size_t i = 0; i < a.size && i < b.size; ++i)
+        if (std::strcmp(a.counters[i].name, "ipc"))
+            a.counters[i].value += b.counters[i].value;
+
+    // a ratio, recomputed from the sums
+    for (size_t i = 0; i < a.size; ++i)
+        if (!std::strcmp(a.counters[i].name, "ipc"))
+            a.counters[i].value = a["cycles"] > 0 ? a["instructions"] / a["cycles"] : 0;
+}
+
+/**
+ * Reports the counts per message as benchmark counters (ipc as is),
+ * averaged over the benchmark threads.
+ */
+inline void report(benchmark::State& state, perf_counters::sample const& sample, double messages, char const* prefix = "")
+{
+    for (auto const& c: sample)
+    {
+        bool const ratio = !std::strcmp(c.name, "ipc");
+        state.counters[std::string(prefix) + c.name] =
+            benchmark::Counter(ratio || !messages ? c.value : c.value / messages, benchmark::Counter::kAvgThreads);
+    }
+}
+
+} // namespace ufw
@@ -0,0 +1,1099 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+/*
+ * The ringbuf.cc scenarios as regression benchmarks.
+ *
+ * The benchmark thread is the producer (ping in ping_pong), the other end runs on
+ * pinned peer threads for the duration of a run. An iteration moves CHUNK messages
+ * end to end and is timed manually with the TSC from the first write to the last
+ * read, so the numbers do not include the thread start and stop.
+ *
+ * Each thread counts its perf events (see perf_counters.h), the benchmark thread
+ * over the timed part only, the peers over the run. Reported per message,
+ * the peers' summed up with the "peer." prefix.
+ *
+ * The *_paced scenarios are open loop: the producer sends on a fixed rate schedule
+ * (the argument, msg/sec) and stamps each message with its intended send time,
+ * the latency percentiles are from that time to the last stage, queueing included.
+ * Swept over the rates they give the latency-throughput curves.
+ * pipeline_batch_paced sets a fixed batch size of the busy middle stage against
+ * an adaptive_batch one over the same rates.
+ *
+ * fan_in compares the ring_selector consumer against polling every ring.
+ *
+ * columns has a consumer of probe3 seq and id only read them from a ringbuf of whole
+ * books against the seq and id columns of a soa_ringbuf.
+ *
+ * chain runs a stage per step of decode -> enrich -> serialize over a typed_pipeline,
+ * changing the type in place, against a ringbuf per hop with a copy into each.
+ *
+ * spsc_queue is the ringbuf scenario over the unbounded queue, the producer never waits.
+ *
+ * probe3_decode sets the scalar varint decoder of the probe3 codec against the SIMD one.
+ *
+ * The mailbox_* scenarios compare the latest value holders under a writer peer
+ * storing as fast as it can, the argument is the number of readers (the benchmark
+ * thread and argument - 1 peers). Reported per read of the benchmark thread, a read
+ * being a load that got a value, the "polls" counter is the rate of all the loads
+ * (the same but for a ringbuf found empty), "writes" the rate the writer kept up meanwhile.
+ */
+
+#include "../ringbuf/adaptive_batch.h"
+#include "../ringbuf/cow.h"
+#include "../ringbuf/load_generator.h"
+#include "../ringbuf/memory_resource.h"
+#include "../ringbuf/pipeline.h"
+#include "../ringbuf/probe3_codec.h"
+#include "../ringbuf/probes.h"
+#include "../ringbuf/ring_selector.h"
+#include "../ringbuf/ringbuf.h"
+#include "../ringbuf/seqlock.h"
+#include "../ringbuf/soa_ringbuf.h"
+#include "../ringbuf/spsc_queue.h"
+#include "../ringbuf/tsc_clock.h"
+#include "perf.h"
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+
+namespace
+{
+
+using myclock = ufw::tsc_clock;
+
+constexpr size_t CHUNK = 1 << 16;    // messages per iteration
+constexpr size_t RTT_CHUNK = 1 << 10; // round trips per ping_pong iteration
+constexpr size_t PACED_CHUNK = 1 << 12; // messages per open loop iteration
+
+void pin_me(size_t cpu_id)
+{
+    cpu_set_t cpuset {};
+    CPU_SET(cpu_id % std::thread::hardware_concurrency(), &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+}
+
+/** pins the benchmark thread for a run, then restores its affinity */
+struct pinned
+{
+    explicit pinned(size_t cpu_id)
+    {
+        pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &saved);
+        pin_me(cpu_id);
+    }
+
+    ~pinned() { pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &saved); }
+
+    cpu_set_t saved;
+};
+
+/** pinned threads running body(stop_flag) until joined */
+struct peers
+{
+    static constexpr size_t MAX_PEERS = 8;
+
+    template <class Func>
+    void spawn(size_t cpu_id, Func func)
+    {
+        auto* const counts = &samples[threads.size()];
+        threads.emplace_back([this, cpu_id, func, counts]() mutable
+        {
+            pin_me(cpu_id);
+            ufw::perf_counters perf;
+            perf.start();
+            func(stop);
+            perf.stop();
+            *counts = perf.read();
+        });
+    }
+
+    /** stops the peers, returns their perf counts */
+    ufw::perf_counters::sample join()
+    {
+        stop = true;
+        ufw::perf_counters::sample total;
+        for (size_t i = 0; i < threads.size(); ++i)
+        {
+            if (threads[i].joinable())
+                threads[i].join();
+            ufw::accumulate(total, samples[i]);
+        }
+        return total;
+    }
+
+    ~peers() { join(); }
+
+    std::atomic<bool> stop {false};
+    std::vector<std::thread> threads;
+    std::array<ufw::perf_counters::sample, MAX_PEERS> samples;
+};
+
+/** the single writer counter a peer publishes its progress with */
+struct alignas(UFW_L1D_LINE_SIZE) progress
+{
+    void add(size_t n) noexcept { count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+
+    void wait(size_t n) const noexcept
+    {
+        while (count.load(std::memory_order_acquire) < n)
+            ufw::zzz();
+    }
+
+    std::atomic<size_t> count {0};
+};
+
+template <class T>
+void stamp(void* node, size_t seq) noexcept { static_cast<T*>(node)->seq = seq; }
+
+template <class T>
+void finish(benchmark::State& state, size_t count)
+{
+    state.SetItemsProcessed(count);
+    state.SetBytesProcessed(count * sizeof(T));
+}
+
+template <class T>
+void finish(benchmark::State& state, size_t count, ufw::perf_counters const& perf, peers& others)
+{
+    finish<T>(state, count);
+    ufw::report(state, perf.read(), count);
+    ufw::report(state, others.join(), count, "peer.");
+}
+
+/**
+ * ringbuf, batched with invokev
+ * @tparam C ring capacity
+ * @tparam N batch size
+ */
+template <class T, size_t C, size_t N = C - 1>
+void ringv(benchmark::State& state)
+{
+    auto ring = std::make_unique<ufw::ringbuf<T, C>>();
+    progress consumed;
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    others.spawn(2, [&](std::atomic<bool>& stop)
+    {
+        while (!stop)
+        {
+            auto const n = ring->template invokev<false, N>([](auto* x, size_t len) noexcept
+            {
+                for (auto end = x + len; x < end; ++x)
+                    benchmark::DoNotOptimize(reinterpret_cast<T*>(x)->seq);
+            });
+            n ? consumed.add(n) : ufw::zzz();
+        }
+    });
+
+    size_t produced = 0;
+    for (auto _: state)
+    {
+        auto const start = myclock::now();
+        perf.start();
+        for (auto const end = produced + CHUNK; produced < end;)
+        {
+            auto const n = ring->template invokev<true, N>([&](auto* x, size_t len) noexcept
+            {
+                for (size_t i = 0; i < len; ++i)
+                    stamp<T>(x + i, produced + i);
+            });
+            if (!n)
+                ufw::zzz();
+            produced += n;
+        }
+        consumed.wait(produced);
+        perf.stop();
+        state.SetIterationTime(std::chrono::duration<double>(myclock::now() - start).count());
+    }
+    finish<T>(state, produced, perf, others);
+}
+
+/**
+ * probe3 book snapshots in a ringbuf (AoS) or a soa_ringbuf (SoA), whole books written,
+ * batches consumed by an aggregation over seq and id only
+ * @tparam C ring capacity
+ */
+template <size_t C, bool SOA>
+void columns(benchmark::State& state)
+{
+    using soa_t = ufw::soa_ringbuf<probe3, C, &probe3::seq, &probe3::id, &probe3::sides>;
+    using ring_t = std::conditional_t<SOA, soa_t, ufw::ringbuf<probe3, C>>;
+    auto ring = std::make_unique<ring_t>();
+    progress consumed;
+
+    probe3 book {};
+    for (auto& side: book.sides)
+        side.depth = 32;
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    others.spawn(2, [&](std::atomic<bool>& stop)
+    {
+        int64_t sum = 0;
+        auto const aggregate = [&sum](size_t len, int64_t const* seq, int64_t const* id) noexcept
+        {
+            for (size_t i = 0; i < len; ++i)
+                sum += seq[i] & 1 ? id[i] : 0;
+        };
+        while (!stop)
+        {
+            size_t n = 0;
+            if constexpr (SOA)
+                n = ring->template invokev<false>([&](size_t len, int64_t* seq, int64_t* id, auto*) noexcept { aggregate(len, seq, id); });
+            else
+                n = ring->template invokev<false>([&](auto* x, size_t len) noexcept
+                {
+                    auto const* books = reinterpret_cast<probe3 const*>(x);
+                    for (size_t i = 0; i < len; ++i)
+                        aggregate(1, &books[i].seq, &books[i].id);
+                });
+            n ? consumed.add(n) : ufw::zzz();
+        }
+        benchmark::DoNotOptimize(sum);
+    });
+
+    size_t produced = 0;
+    for (auto _: state)
+    {
+        auto const start = myclock::now();
+        perf.start();
+        for (auto const end = produced + CHUNK; produced < end;)
+        {
+            size_t n = 0;
+            if constexpr (SOA)
+                n = ring->template invokev<true>([&](size_t len, int64_t* seq, int64_t* id, auto* sides) noexcept
+                {
+                    for (size_t i = 0; i < len; ++i)
+                    {
+                        seq[i] = int64_t(produced + i);
+                        id[i] = int64_t(i);
+                        std::memcpy(sides[i], book.sides, sizeof(book.sides));
+                    }
+                });
+            else
+                n = ring->template invokev<true>([&](auto* x, size_t len) noexcept
+                {
+                    auto* books = reinterpret_cast<probe3*>(x);
+                    for (size_t i = 0; i < len; ++i)
+                    {
+                        books[i] = book;
+                        books[i].seq = int64_t(produced + i);
+                        books[i].id = int64_t(i);
+                    }
+                });
+            if (!n)
+                ufw::zzz();
+            produced += n;
+        }
+        consumed.wait(produced);
+        perf.stop();
+        state.SetIterationTime(std::chrono::duration<double>(myclock::now() - start).count());
+    }
+    finish<probe3>(state, produced, perf, others);
+}
+
+/** a peer per stage 1 .. S - 1, the last one counts the messages through and passes them to last() */
+template <size_t N, class Pipeline, class Last, size_t... X>
+void spawn_stages(peers& others, Pipeline& pipe, progress& consumed, Last& last, std::index_sequence<X...>)
+{
+    auto const stage = [&](auto x)
+    {
+        constexpr size_t STAGE = decltype(x)::value + 1;
+        others.spawn(STAGE + 1, [&pipe, &consumed, &last](std::atomic<bool>& stop)
+        {
+            while (!stop)
+            {
+                auto const n = pipe.template invoke<STAGE, N>([&last](auto& msg) noexcept
+                {
+                    if constexpr (STAGE == Pipeline::LAST_STAGE_ID)
+                        last(msg);
+                    else
+                        benchmark::DoNotOptimize(msg.seq);
+                });
+                if (!n)
+                    ufw::zzz();
+                else if (STAGE == Pipeline::LAST_STAGE_ID)
+                    consumed.add(n);
+            }
+        });
+    };
+    (stage(std::integral_constant<size_t, X>()), ...);
+}
+
+/**
+ * pipeline, the benchmark thread is stage 0 and each of the other stages is a peer
+ * @tparam C ring capacity
+ * @tparam S number of stages
+ * @tparam N batch size
+ */
+template <class T, size_t C, size_t S, size_t N = C>
+void pipeline(benchmark::State& state)
+{
+    using pipeline_t = ufw::pipeline<T, C, S>;
+    auto pipe = std::make_unique<pipeline_t>();
+    progress consumed;
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    auto last = [](T& x) noexcept { benchmark::DoNotOptimize(x.seq); };
+    spawn_stages<N>(others, *pipe, consumed, last, std::make_index_sequence<S - 1>());
+
+    size_t produced = 0;
+    for (auto _: state)
+    {
+        auto const start = myclock::now();
+        perf.start();
+        for (auto const end = produced + CHUNK; produced < end;)
+        {
+            auto const n = pipe->template invoke<0, N>([seq = produced](T& x) mutable noexcept { x.seq = seq++; });
+            if (!n)
+                ufw::zzz();
+            produced += n;
+        }
+        consumed.wait(produced);
+        perf.stop();
+        state.SetIterationTime(std::chrono::duration<double>(myclock::now() - start).count());
+    }
+    finish<T>(state, produced, perf, others);
+}
+
+/** the decode -> enrich -> serialize steps of the chain scenario */
+probe2 decode(probe1 const& x) noexcept
+{
+    probe2 y;
+    static_cast<probe1&>(y) = x;
+    std::memset(y.data, 0, sizeof(y.data));
+    return y;
+}
+
+void enrich(probe2& x) noexcept
+{
+    std::memcpy(x.data, &x.seq, sizeof(x.seq));
+}
+
+probe1 serialize(probe2 const& x) noexcept
+{
+    return probe1 {x.seq, x.id + x.data[0]};
+}
+
+/**
+ * decode -> enrich -> serialize, a stage per step and a peer per stage, over
+ * a typed_pipeline (TYPED) or over a ringbuf per hop, each step copying its result
+ * into the next ring.
+ */
+template <size_t C, bool TYPED>
+void chain(benchmark::State& state)
+{
+    using typed_t = ufw::typed_pipeline<C, probe1, probe1, probe2, probe2, probe1>;
+    auto pipe = std::make_unique<typed_t>();
+    auto raw = std::make_unique<ufw::ringbuf<probe1, C>>();
+    auto decoded = std::make_unique<ufw::ringbuf<probe2, C>>();
+    auto enriched = std::make_unique<ufw::ringbuf<probe2, C>>();
+    auto serialized = std::make_unique<ufw::ringbuf<probe1, C>>();
+    progress consumed;
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    auto const sink = [](probe1 const& x) noexcept { benchmark::DoNotOptimize(x.id); };
+    if constexpr (TYPED)
+    {
+        auto const stage = [&](size_t cpu, auto step)
+        {
+            others.spawn(cpu, [&pipe, &consumed, step](std::atomic<bool>& stop)
+            {
+                constexpr size_t X = decltype(step)::value;
+                while (!stop)
+                {
+                    size_t n = 0;
+                    if constexpr (X == 1)
+                        n = pipe->template invoke<X>([](probe1& x) noexcept { return decode(x); });
+                    else if constexpr (X == 2)
+                        n = pipe->template invoke<X>([](probe2& x) noexcept { enrich(x); });
+                    else if constexpr (X == 3)
+                        n = pipe->template invoke<X>([](probe2& x) noexcept { return serialize(x); });
+                    else
+                        consumed.add(n = pipe->template invoke<X>([](probe1& x) noexcept { benchmark::DoNotOptimize(x.id); }));
+                    if (!n)
+                        ufw::zzz();
+                }
+            });
+        };
+        stage(2, std::integral_constant<size_t, 1>());
+        stage(3, std::integral_constant<size_t, 2>());
+        stage(4, std::integral_constant<size_t, 3>());
+        stage(5, std::integral_constant<size_t, 4>());
+    }
+    else
+    {
+        auto const hop = [&](size_t cpu, auto& in, auto& out, auto step)
+        {
+            others.spawn(cpu, [&in, &out, step](std::atomic<bool>& stop)
+            {
+                while (!stop)
+                    if (!in.take([&](auto&& x) noexcept { while (!out.put(step(x)) && !stop) ufw::zzz(); }))
+                        ufw::zzz();
+            });
+        };
+        hop(2, *raw, *decoded, [](probe1 const& x) noexcept { return decode(x); });
+        hop(3, *decoded, *enriched, [](probe2 x) noexcept { enrich(x); return x; });
+        hop(4, *enriched, *serialized, [](probe2 const& x) noexcept { return serialize(x); });
+        others.spawn(5, [&](std::atomic<bool>& stop)
+        {
+            while (!stop)
+                if (serialized->take(sink))
+                    consumed.add(1);
+                else
+                    ufw::zzz();
+        });
+    }
+
+    size_t produced = 0;
+    for (auto _: state)
+    {
+        auto const start = myclock::now();
+        perf.start();
+        for (auto const end = produced + CHUNK; produced < end;)
+        {
+            size_t n = 0;
+            if constexpr (TYPED)
+                n = pipe->template invoke<0, C>([seq = produced](probe1& x) mutable noexcept { x = probe1 {int64_t(seq++), 0}; });
+            else
+                n = raw->put(probe1 {int64_t(produced), 0});
+            if (!n)
+                ufw::zzz();
+            produced += n;
+        }
+        consumed.wait(produced);
+        perf.stop();
+        state.SetIterationTime(std::chrono::duration<double>(myclock::now() - start).count());
+    }
+    finish<probe1>(state, produced, perf, others);
+}
+
+/** ringbuf, one message at a time with put/take */
+template <class T, size_t C = 1 << 15>
+void ringbuf(benchmark::State& state)
+{
+    auto ring = std::make_unique<ufw::ringbuf<T, C>>();
+    progress consumed;
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    others.spawn(2, [&](std::atomic<bool>& stop)
+    {
+        T dst;
+        while (!stop)
+        {
+            if (ring->take([&](T&& val) noexcept { dst = std::move(val); }))
+                consumed.add(1);
+            else
+                ufw::zzz();
+        }
+        benchmark::DoNotOptimize(dst);
+    });
+
+    size_t produced = 0;
+    for (auto _: state)
+    {
+        auto const start = myclock::now();
+        perf.start();
+        for (auto const end = produced + CHUNK; produced < end; ++produced)
+            while (!ring->put(T{}))
+                ufw::zzz();
+        consumed.wait(produced);
+        perf.stop();
+        state.SetIterationTime(std::chrono::duration<double>(myclock::now() - start).count());
+    }
+    finish<T>(state, produced, perf, others);
+}
+
+/** spsc_queue, the ringbuf scenario with a producer that never waits, the chunks allocated are reported */
+template <class T, size_t C = 1 << 10>
+void spsc_queue(benchmark::State& state)
+{
+    auto queue = std::make_unique<ufw::spsc_queue<T, C>>();
+    progress consumed;
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    others.spawn(2, [&](std::atomic<bool>& stop)
+    {
+        T dst;
+        while (!stop)
+        {
+            if (queue->take([&](T&& val) noexcept { dst = std::move(val); }))
+                consumed.add(1);
+            else
+                ufw::zzz();
+        }
+        benchmark::DoNotOptimize(dst);
+    });
+
+    size_t produced = 0;
+    for (auto _: state)
+    {
+        auto const start = myclock::now();
+        perf.start();
+        for (auto const end = produced + CHUNK; produced < end; ++produced)
+            queue->put(T{});
+        consumed.wait(produced);
+        perf.stop();
+        state.SetIterationTime(std::chrono::duration<double>(myclock::now() - start).count());
+    }
+    finish<T>(state, produced, perf, others);
+    state.counters["chunks"] = queue->allocated();
+}
+
+/**
+ * Fan in over N rings, a producer peer on every N / FAN_IN-th one, the rest idle.
+ * The benchmark thread consumes with the selector or by polling every ring.
+ */
+template <size_t N, bool SELECTOR>
+void fan_in(benchmark::State& state)
+{
+    constexpr size_t FAN_IN = 4;
+    using selector_t = ufw::ring_selector<probe1, 1 << 10, N>;
+    auto selector = std::make_unique<selector_t>();
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    for (size_t p = 0; p < FAN_IN; ++p)
+        others.spawn(2 + p, [&, ring = p * N / FAN_IN](std::atomic<bool>& stop)
+        {
+            for (int64_t seq = 0; !stop;)
+            {
+                probe1 const msg {seq, int64_t(ring)};
+                if (SELECTOR ? selector->put(ring, msg) : selector->ring(ring).put(msg))
+                    ++seq;
+                else
+                    ufw::zzz();
+            }
+        });
+
+    auto const consume = [](auto* x, size_t len) noexcept
+    {
+        for (auto end = x + len; x < end; ++x)
+            benchmark::DoNotOptimize(reinterpret_cast<probe1*>(x)->seq);
+    };
+
+    size_t taken = 0;
+    for (auto _: state)
+    {
+        auto const start = myclock::now();
+        perf.start();
+        for (auto const end = taken + CHUNK; taken < end;)
+        {
+            size_t n = 0;
+            if constexpr (SELECTOR)
+                n = selector->poll([](size_t, probe1&& x) noexcept { benchmark::DoNotOptimize(x.seq); });
+            else
+                for (size_t i = 0; i < N; ++i)
+                    n += selector->ring(i).template invokev<false>(consume);
+            if (!n)
+                ufw::zzz();
+            taken += n;
+        }
+        perf.stop();
+        state.SetIterationTime(std::chrono::duration<double>(myclock::now() - start).count());
+    }
+    finish<probe1>(state, taken, perf, others);
+}
+
+/**
+ * A timestamp bounced between two threads over a pair of rings,
+ * the rtt counter is the mean round trip.
+ */
+template <size_t C>
+void ping_pong(benchmark::State& state)
+{
+    using ring_t = ufw::ringbuf<myclock::time_point, C>;
+    auto fwd = std::make_unique<ring_t>();
+    auto bck = std::make_unique<ring_t>();
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    others.spawn(2, [&](std::atomic<bool>& stop)
+    {
+        while (!stop)
+        {
+            myclock::time_point ts;
+            if (!fwd->template invokev<false, 1>([&](auto* x, size_t n) noexcept { if (n) ts = reinterpret_cast<myclock::time_point&>(*x); }))
+            {
+                ufw::zzz();
+                continue;
+            }
+            while (!bck->template invokev<true, 1>([&](auto* x, size_t) noexcept { reinterpret_cast<myclock::time_point&>(*x) = ts; }))
+                ufw::zzz();
+        }
+    });
+
+    size_t count = 0;
+    for (auto _: state)
+    {
+        auto const start = myclock::now();
+        perf.start();
+        for (size_t i = 0; i < RTT_CHUNK; ++i)
+        {
+            while (!fwd->template invokev<true, 1>([](auto* x, size_t) noexcept { reinterpret_cast<myclock::time_point&>(*x) = myclock::now(); }))
+                ufw::zzz();
+            while (!bck->template invokev<false, 1>([](auto*, size_t) noexcept {}))
+                ufw::zzz();
+        }
+        perf.stop();
+        state.SetIterationTime(std::chrono::duration<double>(myclock::now() - start).count());
+        count += RTT_CHUNK;
+    }
+    state.SetItemsProcessed(count);
+    ufw::report(state, perf.read(), count);
+    ufw::report(state, others.join(), count, "peer.");
+    state.counters["rtt"] = benchmark::Counter(double(count), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+uint64_t ns_since(uint64_t tsc) noexcept
+{
+    return uint64_t(ufw::tsc_cast<myclock::duration>(ufw::rdtsc() - tsc).count() / 1e3);
+}
+
+void report(benchmark::State& state, ufw::latency_histogram const& latency, ufw::pacer const& pace)
+{
+    state.counters["p50_ns"] = latency.percentile(50);
+    state.counters["p99_ns"] = latency.percentile(99);
+    state.counters["p99.9_ns"] = latency.percentile(99.9);
+    state.counters["max_ns"] = latency.max();
+    state.counters["late"] = pace.late();
+}
+
+/** sends PACED_CHUNK messages per iteration on the pace schedule, the intended time in probe1::id */
+template <class Send>
+size_t run_paced(benchmark::State& state, ufw::pacer& pace, ufw::perf_counters& perf, progress const& consumed, Send&& send)
+{
+    size_t produced = 0;
+    for (auto _: state)
+    {
+        auto const start = myclock::now();
+        perf.start();
+        for (auto const end = produced + PACED_CHUNK; produced < end; ++produced)
+        {
+            probe1 const msg {int64_t(produced), int64_t(pace.wait(produced))};
+            while (!send(msg))
+                ufw::zzz();
+        }
+        consumed.wait(produced);
+        perf.stop();
+        state.SetIterationTime(std::chrono::duration<double>(myclock::now() - start).count());
+    }
+    return produced;
+}
+
+/** ringbuf, open loop */
+template <size_t C>
+void ringbuf_paced(benchmark::State& state)
+{
+    auto ring = std::make_unique<ufw::ringbuf<probe1, C>>();
+    progress consumed;
+    ufw::latency_histogram latency;
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    others.spawn(2, [&](std::atomic<bool>& stop)
+    {
+        while (!stop)
+        {
+            if (ring->take([&](probe1&& msg) noexcept { latency.record(ns_since(msg.id)); }))
+                consumed.add(1);
+            else
+                ufw::zzz();
+        }
+    });
+
+    ufw::pacer pace(state.range(0));
+    auto const produced = run_paced(state, pace, perf, consumed, [&](probe1 const& msg) noexcept { return ring->put(msg); });
+    finish<probe1>(state, produced, perf, others);
+    report(state, latency, pace);
+}
+
+/** pipeline, open loop, the last stage measures */
+template <size_t C, size_t S>
+void pipeline_paced(benchmark::State& state)
+{
+    using pipeline_t = ufw::pipeline<probe1, C, S>;
+    auto pipe = std::make_unique<pipeline_t>();
+    progress consumed;
+    ufw::latency_histogram latency;
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    auto last = [&latency](probe1& msg) noexcept { latency.record(ns_since(msg.id)); };
+    spawn_stages<C>(others, *pipe, consumed, last, std::make_index_sequence<S - 1>());
+
+    ufw::pacer pace(state.range(0));
+    auto const produced = run_paced(state, pace, perf, consumed, [&](probe1 const& msg) noexcept
+    {
+        return pipe->template invoke<0, 1>([&](probe1& x) noexcept { x = msg; });
+    });
+    finish<probe1>(state, produced, perf, others);
+    report(state, latency, pace);
+}
+
+/**
+ * pipeline of 3, open loop, the middle stage spends some work on each message and takes
+ * batches of up to N, or as many as an adaptive_batch lets it for a 2us batch (N = 0).
+ * The batch counter is the mean batch size of the middle stage.
+ */
+template <size_t C, size_t N>
+void pipeline_batch_paced(benchmark::State& state)
+{
+    using pipeline_t = ufw::pipeline<probe1, C, 3>;
+    auto pipe = std::make_unique<pipeline_t>();
+    progress consumed;
+    ufw::latency_histogram latency;
+    std::atomic<size_t> batches {0};
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    others.spawn(2, [&](std::atomic<bool>& stop)
+    {
+        auto const work = [](auto* x, size_t len) noexcept
+        {
+            for (size_t i = 0; i < len; ++i)
+            {
+                auto h = uint64_t(reinterpret_cast<probe1&>(x[i]).seq);
+                for (size_t j = 0; j < 16; ++j)
+                    benchmark::DoNotOptimize(h = h * 0x9e3779b97f4a7c15 + j);
+            }
+        };
+        ufw::adaptive_batch batch(1, C, std::chrono::microseconds(2));
+        size_t calls = 0;
+        while (!stop)
+        {
+            size_t n = 0;
+            if constexpr (N > 0)
+                n = pipe->template invokev<1, N>(work);
+            else
+                n = batch.run([&](size_t limit) { return pipe->template invokev_n<1>(limit, work); });
+            if (!n)
+                ufw::zzz();
+            calls += n > 0;
+        }
+        batches = calls;
+    });
+    others.spawn(3, [&](std::atomic<bool>& stop)
+    {
+        while (!stop)
+        {
+            auto const n = pipe->template invoke<2, C>([&latency](probe1& msg) noexcept { latency.record(ns_since(msg.id)); });
+            if (!n)
+                ufw::zzz();
+            else
+                consumed.add(n);
+        }
+    });
+
+    ufw::pacer pace(state.range(0));
+    auto const produced = run_paced(state, pace, perf, consumed, [&](probe1 const& msg) noexcept
+    {
+        return pipe->template invoke<0, 1>([&](probe1& x) noexcept { x = msg; });
+    });
+    finish<probe1>(state, produced, perf, others);
+    report(state, latency, pace);
+    state.counters["batch"] = batches ? double(produced) / batches : 0;
+}
+
+/**
+ * probe3_codec decode of a stream of snapshots, a key frame every 64, in between
+ * a few levels moved by a few ticks, with the scalar or the SIMD varint decoder.
+ */
+template <bool SIMD>
+void probe3_decode(benchmark::State& state)
+{
+    constexpr size_t FRAMES = 1 << 10;
+    std::vector<uint8_t> stream(FRAMES * ufw::probe3_codec::MAX_SIZE);
+    std::vector<size_t> lens;
+
+    probe3 book {};
+    for (auto& side: book.sides)
+    {
+        side.depth = 20;
+        for (int64_t i = 0; i < side.depth; ++i)
+            side.book[i] = {100'000 + 5 * i, 100 * (i + 1)};
+    }
+    size_t bytes = 0;
+    uint64_t rnd = 42;
+    for (size_t f = 0; f < FRAMES; ++f)
+    {
+        auto const ref = book;
+        ++book.seq;
+        for (size_t k = 0; k < 4; ++k)
+        {
+            rnd = rnd * 6364136223846793005ull + 1442695040888963407ull;
+            auto& level = book.sides[rnd >> 63].book[(rnd >> 32) % 20];
+            level.px += int64_t(rnd >> 40 & 7) - 3;
+            level.qty += int64_t(rnd >> 20 & 1023) - 512;
+        }
+        lens.push_back(ufw::probe3_codec::encode(book, f % 64 ? &ref : nullptr, &stream[bytes]));
+        bytes += lens.back();
+    }
+
+    for (auto _: state)
+    {
+        probe3 decoded {};
+        size_t at = 0;
+        for (auto len: lens)
+            at += ufw::probe3_codec::decode<SIMD>(&stream[at], len, decoded);
+        benchmark::DoNotOptimize(decoded);
+        if (at != bytes)
+            state.SkipWithError("malformed");
+    }
+    state.SetItemsProcessed(state.iterations() * FRAMES);
+    state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+/** cow snapshot readers, every thread loads */
+void cow_load(benchmark::State& state)
+{
+    static ufw::cow<probe3> book;
+    if (!state.thread_index())
+        book.store(probe3 {});
+
+    for (auto _: state)
+        benchmark::DoNotOptimize(book.load());
+    state.SetItemsProcessed(state.iterations());
+}
+
+/** cow snapshot writer, a new snapshot per store, allocated with Alloc (over a pool_resource if pmr) */
+template <class Alloc>
+void cow_store(benchmark::State& state)
+{
+    ufw::pool_resource pool;
+    ufw::cow<probe3, Alloc> book([&] {
+        if constexpr (std::is_constructible<Alloc, std::pmr::memory_resource*>::value)
+            return Alloc(&pool);
+        else
+            return Alloc();
+    }());
+    probe3 snapshot {};
+
+    for (auto _: state)
+    {
+        ++snapshot.seq;
+        book.store(snapshot);
+    }
+    finish<probe3>(state, state.iterations());
+}
+
+/** seqlock, readers copy the latest value out */
+template <class T, size_t SLOTS>
+struct seqlock_box
+{
+    explicit seqlock_box(size_t) noexcept {}
+    void store(T const& x) noexcept { box.store(x); }
+    bool load(size_t, T& last) const noexcept { box.load(last); return true; }
+
+    ufw::seqlock<T, SLOTS> box;
+};
+
+/** cow, a snapshot allocation per store, a refcount round trip per read */
+template <class T>
+struct cow_box
+{
+    explicit cow_box(size_t) { box.store(T {}); }
+    void store(T const& x) { box.store(x); }
+    bool load(size_t, T& last) { last = *box.load(); return true; }
+
+    ufw::cow<T> box;
+};
+
+/**
+ * A ringbuf of depth 1 per reader, the writer puts where there is room, a reader keeps the last value
+ * it took. A take from an empty ring copies nothing and is a poll, not a read.
+ */
+template <class T>
+struct ringbuf_box
+{
+    explicit ringbuf_box(size_t readers) noexcept: readers(readers) {}
+
+    void store(T const& x) noexcept
+    {
+        for (size_t i = 0; i < readers; ++i)
+            rings[i].put(x);
+    }
+
+    bool load(size_t reader, T& last) noexcept { return rings[reader].take([&](T&& x) noexcept { last = x; }); }
+
+    size_t const readers;
+    std::array<ufw::ringbuf<T, 2>, peers::MAX_PEERS> rings;
+};
+
+template <class Box, class T>
+void mailbox(benchmark::State& state)
+{
+    auto box = std::make_unique<Box>(state.range(0));
+    progress written;
+
+    pinned me(1);
+    ufw::perf_counters perf;
+    peers others;
+    others.spawn(2, [&](std::atomic<bool>& stop)
+    {
+        T x {};
+        for (x.seq = 1; !stop; ++x.seq)
+        {
+            box->store(x);
+            written.add(1);
+        }
+    });
+    for (size_t reader = 1; reader < size_t(state.range(0)); ++reader)
+        others.spawn(2 + reader, [&, reader](std::atomic<bool>& stop)
+        {
+            T x {};
+            while (!stop)
+            {
+                box->load(reader, x);
+                benchmark::DoNotOptimize(x.seq);
+            }
+        });
+
+    size_t reads = 0;
+    size_t polls = 0;
+    size_t writes = 0;
+    double elapsed = 0;
+    T x {};
+    for (auto _: state)
+    {
+        auto const start = myclock::now();
+        auto const before = written.count.load(std::memory_order_acquire);
+        perf.start();
+        for (size_t i = 0; i < CHUNK; ++i)
+        {
+            reads += box->load(0, x);
+            benchmark::DoNotOptimize(x.seq);
+        }
+        perf.stop();
+        writes += written.count.load(std::memory_order_acquire) - before;
+        auto const time = std::chrono::duration<double>(myclock::now() - start).count();
+        state.SetIterationTime(time);
+        elapsed += time;
+        polls += CHUNK;
+    }
+    state.SetItemsProcessed(reads);
+    ufw::report(state, perf.read(), reads);
+    ufw::report(state, others.join(), reads, "peer.");
+    state.counters["writes"] = elapsed > 0 ? writes / elapsed : 0;
+    state.counters["polls"] = elapsed > 0 ? polls / elapsed : 0;
+}
+
+#define UFW_PAIR(...) BENCHMARK_TEMPLATE(__VA_ARGS__)->UseManualTime()->Unit(benchmark::kMicrosecond)
+
+UFW_PAIR(ping_pong, 1 << 6);
+UFW_PAIR(ping_pong, 1 << 15);
+UFW_PAIR(ping_pong, 1 << 20);
+
+UFW_PAIR(pipeline, probe1, 1 << 6, 2);
+UFW_PAIR(pipeline, probe1, 1 << 6, 3);
+UFW_PAIR(pipeline, probe1, 1 << 15, 2);
+UFW_PAIR(pipeline, probe1, 1 << 15, 3);
+UFW_PAIR(pipeline, probe1, 1 << 15, 4);
+UFW_PAIR(pipeline, probe1, 1 << 15, 3, 64);
+UFW_PAIR(pipeline, probe3, 1 << 15, 3);
+UFW_PAIR(pipeline, probe1, 1 << 20, 3);
+
+UFW_PAIR(columns, 1 << 10, false);
+UFW_PAIR(columns, 1 << 10, true);
+
+UFW_PAIR(chain, 1 << 10, false);
+UFW_PAIR(chain, 1 << 10, true);
+
+UFW_PAIR(ringv, probe1, 1 << 5);
+UFW_PAIR(ringv, probe1, 1 << 10);
+UFW_PAIR(ringv, probe1, 1 << 10, 16);
+UFW_PAIR(ringv, probe1, 1 << 14);
+UFW_PAIR(ringv, probe1, 1 << 14, 64);
+UFW_PAIR(ringv, probe2, 1 << 5);
+UFW_PAIR(ringv, probe2, 1 << 10);
+UFW_PAIR(ringv, probe2, 1 << 14);
+UFW_PAIR(ringv, probe3, 1 << 5);
+UFW_PAIR(ringv, probe3, 1 << 10);
+UFW_PAIR(ringv, probe3, 1 << 14);
+
+#define UFW_PACED(...) UFW_PAIR(__VA_ARGS__)->Arg(10'000)->Arg(100'000)->Arg(1'000'000)->Arg(10'000'000)
+
+UFW_PACED(ringbuf_paced, 1 << 10);
+UFW_PACED(ringbuf_paced, 1 << 15);
+UFW_PACED(pipeline_paced, 1 << 10, 2);
+UFW_PACED(pipeline_paced, 1 << 10, 3);
+UFW_PACED(pipeline_batch_paced, 1 << 12, 16);
+UFW_PACED(pipeline_batch_paced, 1 << 12, 1 << 12);
+UFW_PACED(pipeline_batch_paced, 1 << 12, 0);
+
+UFW_PAIR(ringbuf, probe1);
+UFW_PAIR(ringbuf, probe2);
+UFW_PAIR(ringbuf, probe3);
+
+UFW_PAIR(fan_in, 8, false);
+UFW_PAIR(fan_in, 8, true);
+UFW_PAIR(fan_in, 32, false);
+UFW_PAIR(fan_in, 32, true);
+
+UFW_PAIR(spsc_queue, probe1);
+UFW_PAIR(spsc_queue, probe2);
+UFW_PAIR(spsc_queue, probe3);
+
+#define UFW_MAILBOX(...) UFW_PAIR(mailbox, __VA_ARGS__)->DenseRange(1, 4)->Arg(peers::MAX_PEERS - 1)
+
+UFW_MAILBOX(seqlock_box<probe1, 1>, probe1);
+UFW_MAILBOX(seqlock_box<probe1, 4>, probe1);
+UFW_MAILBOX(cow_box<probe1>, probe1);
+UFW_MAILBOX(ringbuf_box<probe1>, probe1);
+UFW_MAILBOX(seqlock_box<probe3, 1>, probe3);
+UFW_MAILBOX(seqlock_box<probe3, 4>, probe3);
+UFW_MAILBOX(cow_box<probe3>, probe3);
+UFW_MAILBOX(ringbuf_box<probe3>, probe3);
+
+BENCHMARK_TEMPLATE(probe3_decode, false);
+#if UFW_VARINT_SIMD
+BENCHMARK_TEMPLATE(probe3_decode, true);
+#endif
+
+BENCHMARK(cow_load)->ThreadRange(1, 8);
+BENCHMARK_TEMPLATE(cow_store, std::allocator<probe3>);
+BENCHMARK_TEMPLATE(cow_store, std::pmr::polymorphic_allocator<probe3>);
+
+} // local namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,176 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "../ringbuf/mirror_buffer.h"
+#include "../ringbuf/pipeline.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include <sys/socket.h>
+
+namespace ufw {
+
+/** a frame payload in place in the receive ring */
+struct frame_view
+{
+    char const* data;
+    uint32_t len;
+    size_t end; // free running ring offset past the frame
+};
+
+/**
+ * Zero-copy reader of a stream of length-prefixed frames.
+ *
+ * Frames are a native uint32_t payload length followed by the payload. The bytes
+ * are received into a mirror_buffer and the frames are parsed in place, a frame
+ * wrapping around the end of the ring is contiguous in the mirror half, so views
+ * are handed out without a copy in every case.
+ *
+ * Stage 0 of the pipeline is the reader, it publishes a frame_view per frame
+ * to the consumer stages 1 .. STAGES - 1. Each view stays valid until the last
+ * stage releases it, only then its bytes are reused for the next receives.
+ *
+ * @tparam SLOTS pipeline capacity, the maximum number of frames in flight
+ * @tparam STAGES number of pipeline stages, the reader included
+ */
+template <size_t SLOTS = 1024, size_t STAGES = 2>
+class frame_reader
+{
+public:
+    using pipeline_t = pipeline<frame_view, SLOTS, STAGES>;
+    static constexpr size_t PREFIX = sizeof(uint32_t);
+
+    /** @param capacity receive ring size, the upper bound of a frame with its prefix */
+    explicit frame_reader(size_t capacity): ring_(capacity) {}
+
+    /**
+     * Stage 0: free space of the ring to receive into, may be empty.
+     * Contiguous even when it wraps.
+     */
+    std::pair<char*, size_t> prepare() noexcept
+    {
+        auto const used = head_ - reclaimed_.load(std::memory_order_acquire);
+        return {ring_.at(head_), ring_.size() - used};
+    }
+
+    /**
+     * Stage 0: n bytes were written to the prepared space, publishes the complete frames.
+     * @return number of frames published, throws std::length_error on a frame bigger than the ring
+     */
+    size_t commit(size_t n)
+    {
+        head_ += n;
+        return publish();
+    }
+
+    /**
+     * Stage 0: receives what the socket has and the ring can take, never blocks.
+     * @return number of frames published, -1 on end of stream or error (see error())
+     */
+    ssize_t read(int fd)
+    {
+        auto const space = prepare();
+        if (!space.second)
+            return publish();
+
+        auto const n = ::recv(fd, space.first, space.second, MSG_DONTWAIT);
+        if (n > 0)
+            return commit(n);
+        if (!n || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+        {
+            error_ = n ? errno : 0;
+            return -1;
+        }
+        return publish();
+    }
+
+    /**
+     * Stages 1 .. STAGES - 1.
+     * Callback signature: void(frame_view const&)
+     */
+    template <size_t X, size_t BATCH_SIZE = SLOTS, class Func>
+    size_t consume(Func&& func) noexcept
+    {
+        static_assert(X > 0 && X < STAGES, "stage 0 is the reader");
+
+        size_t end = 0;
+        auto const n = pipe_.template invokev<X, BATCH_SIZE>([&](auto* nodes, size_t len) noexcept
+        {
+            auto const* views = reinterpret_cast<frame_view const*>(nodes);
+            for (size_t i = 0; i < len; ++i)
+                func(views[i]);
+            if (len)
+                end = views[len - 1].end;
+        });
+
+        // frames are released in order, everything before the last one is free
+        if (X == pipeline_t::LAST_STAGE_ID && n)
+            reclaimed_.store(end, std::memory_order_release);
+        return n;
+    }
+
+    int error() const noexcept { return error_; }
+
+    /** bytes received and not yet released */
+    size_t backlog() const noexcept { return head_ - reclaimed_.load(std::memory_order_relaxed); }
+
+private:
+    size_t publish()
+    {
+        size_t n = 0;
+        while (head_ - parsed_ >= PREFIX)
+        {
+            uint32_t len;
+            std::memcpy(&len, ring_.at(parsed_), PREFIX);
+            if (PREFIX + len > ring_.size())
+                throw std::length_error("frame_reader: frame bigger than the ring");
+            if (head_ - parsed_ < PREFIX + len)
+                break;
+
+            frame_view const view {ring_.at(parsed_ + PREFIX), len, parsed_ + PREFIX + len};
+            if (!pipe_.template invokev<0, 1>([&](auto* node, size_t k) noexcept
+            {
+                if (k)
+                    new(node) frame_view(view);
+            }))
+            {
+                break; // all slots in flight, retried on the next call
+            }
+
+            parsed_ = view.end;
+            ++n;
+        }
+        return n;
+    }
+
+    mirror_buffer ring_;
+    pipeline_t pipe_;
+
+    size_t head_ = 0;   // received
+    size_t parsed_ = 0; // published as frames
+    int error_ = 0;
+
+    alignas(UFW_L1D_LINE_SIZE) std::atomic<size_t> reclaimed_ {0}; // released by the last stage
+};
+
+} // namespace ufw
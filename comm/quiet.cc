@@ -1,88 +1,812 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#include "frame_reader.h"
+#include "reactor.h"
+#include "session_writer.h"
+#include "udp_receiver.h"
+#include "uring.h"
+#include "../ringbuf/load_generator.h"
 #include "../ringbuf/tsc_clock.h"
 
 #include <boost/asio.hpp>
+#include <boost/program_options.hpp>
 
 #include <boost/accumulators/accumulators.hpp>
 #include <boost/accumulators/statistics/stats.hpp>
-#include <boost/accumulators/statistics/min.hpp>
-#include <boost/accumulators/statistics/max.hpp>
 #include <boost/accumulators/statistics/mean.hpp>
 #include <boost/accumulators/statistics/variance.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <thread>
 #include <memory>
 #include <atomic>
 #include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
 
 using namespace boost::asio;
 using namespace boost::accumulators;
 
-int main()
+namespace {
+
+using clock = ufw::tsc_clock;
+
+struct options
 {
-    using clock = ufw::tsc_clock;
-    clock::scale();
+    std::string probe;
+    std::string transport;
+    std::string loop;
+    std::string io;
+    size_t size;
+    size_t count;
+    size_t warmup;
+    double rate;
+    unsigned short port;
+    std::string path;
+    bool nodelay;
+    int notsent_lowat;
+    int sndbuf;
+    int rcvbuf;
+    int sender_cpu;
+    int receiver_cpu;
+    std::vector<double> sweep;
+};
 
-    io_service loop;
+/** a point of the latency-throughput curve */
+struct load_point
+{
+    double rate;
+    double p50, p99, p999, max;
+    size_t late;
+};
 
-    auto work = std::make_unique<io_service::work>(loop);
+std::vector<load_point> curve;
+
+void pin_me(int cpu_id)
+{
+    if (cpu_id < 0)
+        return;
+    cpu_set_t cpuset {};
+    CPU_SET(cpu_id, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+}
+
+template <class Duration>
+double to_us(Duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+void report(char const* name, options const& opt, std::vector<double>& lat, ufw::pacer const& pace, size_t lost = 0)
+{
+    std::clog << name;
+    if (opt.probe == "post")
+        std::clog << ' ' << opt.loop;
+    else
+        std::clog << ' ' << opt.transport << ", " << opt.size << 'B';
+    std::clog << " x " << opt.count << " @ ";
+    if (opt.rate > 0)
+        std::clog << opt.rate << "/sec";
+    else
+        std::clog << "max rate";
+    std::clog << ", " << lat.size() << " samples";
+    if (lost)
+        std::clog << ", " << lost << " lost";
+    if (pace.late())
+        std::clog << ", " << pace.late() << " sent late, up to " << to_us(pace.max_lag()) << " us";
+    std::clog << std::endl;
+
+    if (lat.empty())
+        return;
+
+    accumulator_set<double, stats<tag::mean, tag::variance>> acc;
+    std::for_each(lat.begin(), lat.end(), std::ref(acc));
+    std::sort(lat.begin(), lat.end());
+
+    auto const pct = [&](double p) { return lat[std::min(lat.size() - 1, size_t(p / 100.0 * lat.size()))]; };
+
+    std::clog << std::fixed << std::setprecision(3)
+              << "min:    " << lat.front() << " us\n"
+              << "p50:    " << pct(50) << " us\n"
+              << "p90:    " << pct(90) << " us\n"
+              << "p99:    " << pct(99) << " us\n"
+              << "p99.9:  " << pct(99.9) << " us\n"
+              << "p99.99: " << pct(99.99) << " us\n"
+              << "max:    " << lat.back() << " us\n"
+              << "mean:   " << mean(acc) << " us\n"
+              << "stddev: " << std::sqrt(variance(acc)) << " us" << std::endl;
+
+    curve.push_back({opt.rate, pct(50), pct(99), pct(99.9), lat.back(), pace.late()});
+}
+
+/*
+ * Socket setup
+ */
+
+template <class Socket>
+void tune(Socket& s, options const& opt)
+{
+    if (opt.sndbuf > 0)
+        s.set_option(socket_base::send_buffer_size(opt.sndbuf));
+    if (opt.rcvbuf > 0)
+        s.set_option(socket_base::receive_buffer_size(opt.rcvbuf));
+
+    // data is received with plain recv(), so the timeout covers lost datagrams
+    timeval tv {1, 0};
+    setsockopt(s.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+void tune(ip::tcp::socket& s, options const& opt)
+{
+    tune<ip::tcp::socket>(s, opt);
+
+    s.set_option(ip::tcp::no_delay(opt.nodelay));
+    if (opt.notsent_lowat > 0 &&
+        setsockopt(s.native_handle(), IPPROTO_TCP, TCP_NOTSENT_LOWAT, &opt.notsent_lowat, sizeof(opt.notsent_lowat)))
+    {
+        std::clog << "TCP_NOTSENT_LOWAT: " << std::strerror(errno) << std::endl;
+    }
+}
+
+template <class Protocol>
+struct connection
+{
+    typename Protocol::socket tx;
+    typename Protocol::socket rx;
+};
+
+connection<ip::tcp> connect_tcp(io_service& loop, options const& opt)
+{
+    ip::tcp::acceptor acceptor(loop, ip::tcp::endpoint(ip::address_v4::loopback(), opt.port));
+    connection<ip::tcp> conn {ip::tcp::socket(loop), ip::tcp::socket(loop)};
+    conn.tx.connect(acceptor.local_endpoint());
+    acceptor.accept(conn.rx);
+    return conn;
+}
+
+connection<ip::udp> connect_udp(io_service& loop, options const& opt)
+{
+    connection<ip::udp> conn {
+        ip::udp::socket(loop, ip::udp::endpoint(ip::address_v4::loopback(), 0)),
+        ip::udp::socket(loop, ip::udp::endpoint(ip::address_v4::loopback(), opt.port))
+    };
+    conn.tx.connect(conn.rx.local_endpoint());
+    conn.rx.connect(conn.tx.local_endpoint());
+    return conn;
+}
+
+connection<local::stream_protocol> connect_unix(io_service& loop, options const& opt)
+{
+    ::unlink(opt.path.c_str());
+    local::stream_protocol::acceptor acceptor(loop, local::stream_protocol::endpoint(opt.path));
+    connection<local::stream_protocol> conn {local::stream_protocol::socket(loop), local::stream_protocol::socket(loop)};
+    conn.tx.connect(acceptor.local_endpoint());
+    acceptor.accept(conn.rx);
+    ::unlink(opt.path.c_str());
+    return conn;
+}
+
+/*
+ * Blocking message I/O on the native handles, messages are stamped
+ * in the first bytes with their intended send time (see ufw::pacer)
+ * and their sequence number
+ */
+
+bool send_msg(int fd, char const* buf, size_t len)
+{
+    for (size_t sent = 0; sent < len;)
+    {
+        auto const n = ::send(fd, buf + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+/** reads exactly len bytes of a stream or one datagram, false on timeout or error */
+bool recv_msg(int fd, char* buf, size_t len, bool stream)
+{
+    if (!stream)
+        return ::recv(fd, buf, len, 0) > 0;
+
+    for (size_t received = 0; received < len;)
+    {
+        auto const n = ::recv(fd, buf + received, len - received, 0);
+        if (n <= 0)
+            return false;
+        received += n;
+    }
+    return true;
+}
+
+clock::time_point time_of(uint64_t tsc) { return clock::time_point {ufw::tsc_cast<clock::duration>(tsc)}; }
+constexpr size_t STAMP_SIZE = sizeof(clock::time_point) + sizeof(uint64_t);
+
+void stamp(char* buf, uint64_t tsc, uint64_t seq = 0)
+{
+    auto const then = time_of(tsc);
+    std::memcpy(buf, &then, sizeof(then));
+    std::memcpy(buf + sizeof(then), &seq, sizeof(seq));
+}
+clock::time_point stamp_of(char const* buf) { clock::time_point then; std::memcpy(&then, buf, sizeof(then)); return then; }
+uint64_t seq_of(char const* buf) { uint64_t seq; std::memcpy(&seq, buf + sizeof(clock::time_point), sizeof(seq)); return seq; }
+
+/*
+ * Probes
+ */
+
+/**
+ * Sender-to-receiver latency, the receiver runs on its own thread. A timeout is a lost
+ * datagram or a slow sender, the receiver carries on until the sender is done and
+ * counts what never arrived, warmup messages are told apart by their sequence number.
+ */
+template <class Protocol>
+void probe_oneway(connection<Protocol>& conn, options const& opt, bool stream)
+{
+    std::vector<double> lat;
+    lat.reserve(opt.count);
+    size_t const total = opt.warmup + opt.count;
+    size_t received = 0;
+    std::atomic<bool> sent {false};
+
+    std::thread receiver([&]
+    {
+        pin_me(opt.receiver_cpu);
+        std::vector<char> buf(opt.size);
+        while (received < total)
+        {
+            if (!recv_msg(conn.rx.native_handle(), buf.data(), buf.size(), stream))
+            {
+                if (sent)
+                    break;
+                continue;
+            }
+            auto const now = clock::now();
+            ++received;
+            if (seq_of(buf.data()) >= opt.warmup)
+                lat.push_back(to_us(now - stamp_of(buf.data())));
+        }
+    });
+
+    pin_me(opt.sender_cpu);
+    std::vector<char> buf(opt.size);
+    ufw::pacer pace(opt.rate);
+    for (size_t i = 0; i < total; ++i)
+    {
+        stamp(buf.data(), pace.wait(i), i);
+        if (!send_msg(conn.tx.native_handle(), buf.data(), buf.size()))
+            break;
+    }
+    sent = true;
+
+    receiver.join();
+    report("one-way", opt, lat, pace, total - std::min(received, total));
+}
+
+template <class Protocol>
+void probe_oneway_batched(connection<Protocol>&, options const&)
+{
+    throw std::invalid_argument("the batched writer is tcp only");
+}
+
+/** same as above, the sender queues to a session_writer drained by a network thread */
+void probe_oneway_batched(connection<ip::tcp>& conn, options const& opt)
+{
+    using message_t = ufw::out_message<2048>;
+    if (opt.size > message_t::CAPACITY)
+        throw std::invalid_argument("message too big for the batched writer");
+
+    std::vector<double> lat;
+    lat.reserve(opt.count);
+    size_t lost = 0;
+    size_t const total = opt.warmup + opt.count;
+
+    std::thread receiver([&]
+    {
+        pin_me(opt.receiver_cpu);
+        std::vector<char> buf(opt.size);
+        for (size_t i = 0; i < total; ++i)
+        {
+            if (!recv_msg(conn.rx.native_handle(), buf.data(), buf.size(), true))
+            {
+                lost = total - i;
+                break;
+            }
+            auto const now = clock::now();
+            if (i >= opt.warmup)
+                lat.push_back(to_us(now - stamp_of(buf.data())));
+        }
+    });
+
+    auto writer = std::make_unique<ufw::session_writer<message_t>>(
+            conn.tx.native_handle(), opt.notsent_lowat > 0 ? opt.notsent_lowat : 4096);
+
+    std::thread network([&]
+    {
+        pollfd pfd {conn.tx.native_handle(), POLLOUT, 0};
+        while (writer->messages() < total)
+        {
+            if (writer->flush() < 0)
+                break;
+            if (writer->blocked())
+                ::poll(&pfd, 1, 1);
+        }
+    });
+
+    pin_me(opt.sender_cpu);
+    std::vector<char> buf(opt.size);
+    ufw::pacer pace(opt.rate);
+    for (size_t i = 0; i < total; ++i)
+    {
+        stamp(buf.data(), pace.wait(i));
+        writer->post(buf.data(), buf.size());
+    }
+
+    network.join();
+    receiver.join();
+    report("one-way batched", opt, lat, pace, lost);
+    std::clog << "writev: " << writer->syscalls() << " calls, "
+              << double(writer->messages()) / std::max<size_t>(writer->syscalls(), 1) << " msg/call" << std::endl;
+}
+
+/**
+ * One-way over uring_transport on both ends, each thread polls its own transport.
+ * A stream delivers arbitrary chunks, the receiver reassembles the messages.
+ */
+template <class Protocol>
+void probe_oneway_uring(connection<Protocol>& conn, options const& opt, bool stream)
+{
+    using transport_t = ufw::uring_transport<>;
+    auto const backend = opt.io == "posix" ? transport_t::backend::POSIX : transport_t::backend::URING;
+
+    std::vector<double> lat;
+    lat.reserve(opt.count);
+    size_t lost = 0;
+    size_t const total = opt.warmup + opt.count;
+    std::atomic<bool> done {false};
+
+    auto rx = std::make_unique<transport_t>(conn.rx.native_handle(), stream, 256, 2048, 1u << 20, backend);
+    auto tx = std::make_unique<transport_t>(conn.tx.native_handle(), stream, 256, 2048, 1u << 20, backend);
+    if (rx->mode() != backend)
+        std::clog << "io_uring not available, falling back to recv/send" << std::endl;
+
+    std::thread receiver([&]
+    {
+        pin_me(opt.receiver_cpu);
+        std::vector<char> msg(opt.size);
+        size_t i = 0, have = 0;
+        auto deadline = clock::now() + std::chrono::seconds(1);
+
+        auto const on_message = [&]
+        {
+            auto const now = clock::now();
+            if (i++ >= opt.warmup)
+                lat.push_back(to_us(now - stamp_of(msg.data())));
+            deadline = now + std::chrono::seconds(1);
+        };
+
+        while (i < total && !rx->error() && !rx->eof())
+        {
+            rx->poll();
+            while (rx->rx().take([&](ufw::rx_event const& ev) noexcept
+            {
+                if (!stream)
+                {
+                    std::memcpy(msg.data(), ev.data, std::min<size_t>(sizeof(clock::time_point), ev.len));
+                    on_message();
+                }
+                else for (size_t at = 0; at < ev.len;)
+                {
+                    auto const n = std::min(ev.len - at, opt.size - have);
+                    std::memcpy(&msg[have], ev.data + at, n);
+                    at += n;
+                    if ((have += n) == opt.size)
+                    {
+                        have = 0;
+                        on_message();
+                    }
+                }
+                rx->release(ev.bid);
+            }));
 
-    using acc_t = accumulator_set<double, stats<tag::min, tag::max, tag::mean, tag::variance>>;
-    acc_t acc;
+            if (clock::now() > deadline)
+                break;
+        }
+        lost = total - std::min(i, total);
+        done = true;
+    });
+
+    pin_me(opt.sender_cpu);
+    std::vector<char> buf(opt.size);
+    ufw::pacer pace(opt.rate);
+    for (size_t i = 0; i < total && !done; ++i)
+    {
+        stamp(buf.data(), pace.wait(i));
+        while (!tx->send(buf.data(), buf.size()) && !tx->error())
+            tx->poll();
+        tx->poll();
+    }
+    while (!done)
+        tx->poll();
+
+    receiver.join();
+    report(rx->mode() == transport_t::backend::URING ? "one-way io_uring" : "one-way recv/send", opt, lat, pace, lost);
+    std::clog << "syscalls: " << tx->syscalls() << " tx, " << rx->syscalls() << " rx" << std::endl;
+}
+
+template <class Protocol>
+void probe_oneway_mmsg(connection<Protocol>&, options const&)
+{
+    throw std::invalid_argument("the batched receiver is udp only");
+}
+
+/** one-way, the network thread receives in batches into ring slots drained by the receiver thread */
+void probe_oneway_mmsg(connection<ip::udp>& conn, options const& opt)
+{
+    using receiver_t = ufw::udp_receiver<2048>;
+    if (opt.size > 2048)
+        throw std::invalid_argument("message too big for the batched receiver");
+
+    std::vector<double> lat;
+    lat.reserve(opt.count);
+    size_t const total = opt.warmup + opt.count;
+    size_t received = 0;
+    std::atomic<bool> done {false};
+
+    auto udp = std::make_unique<receiver_t>(conn.rx.native_handle());
+
+    std::thread network([&]
+    {
+        while (!done && udp->receive() >= 0);
+    });
+
+    std::thread receiver([&]
+    {
+        pin_me(opt.receiver_cpu);
+        auto deadline = clock::now() + std::chrono::seconds(1);
+        while (received < total && clock::now() < deadline)
+        {
+            while (udp->ring().take([&](receiver_t::slot_t const& slot) noexcept
+            {
+                clock::time_point const at {ufw::tsc_cast<clock::duration>(slot.tsc)};
+                if (received++ >= opt.warmup)
+                    lat.push_back(to_us(at - stamp_of(slot.payload)));
+                deadline = clock::now() + std::chrono::seconds(1);
+            }));
+        }
+        done = true;
+    });
+
+    pin_me(opt.sender_cpu);
+    std::vector<char> buf(opt.size);
+    ufw::pacer pace(opt.rate);
+    for (size_t i = 0; i < total && !done; ++i)
+    {
+        stamp(buf.data(), pace.wait(i));
+        send_msg(conn.tx.native_handle(), buf.data(), buf.size());
+    }
+
+    receiver.join();
+    network.join();
+    report("one-way recvmmsg", opt, lat, pace, total - std::min(received, total));
+    std::clog << "recvmmsg: " << udp->syscalls() << " calls, "
+              << double(udp->datagrams()) / std::max<size_t>(udp->syscalls(), 1) << " msg/call" << std::endl;
+}
+
+/** one-way of length-prefixed frames parsed in place, the receiver runs both pipeline stages */
+template <class Protocol>
+void probe_oneway_framed(connection<Protocol>& conn, options const& opt, bool stream)
+{
+    if (!stream)
+        throw std::invalid_argument("framing is for stream transports");
 
+    std::vector<double> lat;
+    lat.reserve(opt.count);
+    size_t const total = opt.warmup + opt.count;
+    size_t received = 0;
+
+    auto reader = std::make_unique<ufw::frame_reader<>>(1u << 20);
+
+    std::thread receiver([&]
+    {
+        pin_me(opt.receiver_cpu);
+        auto deadline = clock::now() + std::chrono::seconds(1);
+        while (received < total && clock::now() < deadline && reader->read(conn.rx.native_handle()) >= 0)
+        {
+            reader->consume<1>([&](ufw::frame_view const& frame) noexcept
+            {
+                auto const now = clock::now();
+                if (received++ >= opt.warmup)
+                    lat.push_back(to_us(now - stamp_of(frame.data)));
+                deadline = now + std::chrono::seconds(1);
+            });
+        }
+    });
+
+    pin_me(opt.sender_cpu);
+    std::vector<char> buf(sizeof(uint32_t) + opt.size);
+    uint32_t const len = opt.size;
+    std::memcpy(buf.data(), &len, sizeof(len));
+    ufw::pacer pace(opt.rate);
+    for (size_t i = 0; i < total; ++i)
+    {
+        stamp(buf.data() + sizeof(len), pace.wait(i));
+        if (!send_msg(conn.tx.native_handle(), buf.data(), buf.size()))
+            break;
+    }
+
+    receiver.join();
+    report("one-way framed", opt, lat, pace, total - std::min(received, total));
+}
+
+/** round trip through an echo thread, an echo late past the timeout is told apart by its sequence number and dropped */
+template <class Protocol>
+void probe_rtt(connection<Protocol>& conn, options const& opt, bool stream)
+{
+    std::atomic<bool> must_continue {true};
+
+    std::thread echo([&]
+    {
+        pin_me(opt.receiver_cpu);
+        std::vector<char> buf(opt.size);
+        while (must_continue)
+        {
+            if (recv_msg(conn.rx.native_handle(), buf.data(), buf.size(), stream))
+                send_msg(conn.rx.native_handle(), buf.data(), buf.size());
+        }
+    });
+
+    pin_me(opt.sender_cpu);
+    std::vector<double> lat;
+    lat.reserve(opt.count);
+    size_t lost = 0;
+    std::vector<char> buf(opt.size);
+    ufw::pacer pace(opt.rate);
+    for (size_t i = 0; i < opt.warmup + opt.count; ++i)
+    {
+        stamp(buf.data(), pace.wait(i), i);
+        bool ok = send_msg(conn.tx.native_handle(), buf.data(), buf.size());
+        while (ok && (ok = recv_msg(conn.tx.native_handle(), buf.data(), buf.size(), stream)) && seq_of(buf.data()) != i);
+        if (!ok)
+        {
+            ++lost;
+            continue;
+        }
+        auto const now = clock::now();
+        if (i >= opt.warmup)
+            lat.push_back(to_us(now - stamp_of(buf.data())));
+    }
+
+    must_continue = false;
+    conn.tx.shutdown(socket_base::shutdown_both);
+    echo.join();
+    report("rtt", opt, lat, pace, lost);
+}
+
+/** latency to post a functor to the io_service thread */
+void probe_post(io_service& loop, options const& opt)
+{
+    std::vector<double> lat;
+    lat.reserve(opt.count);
+
+    auto work = std::make_unique<io_service::work>(loop);
     std::thread thread([&]
     {
+        pin_me(opt.receiver_cpu);
         loop.run();
-        std::atomic_thread_fence(std::memory_order_release);
     });
 
-    using boost::system::error_code;
-    ip::tcp::acceptor acceptor(loop, ip::tcp::endpoint(ip::tcp::v4(), 2222));
-    ip::tcp::socket asocket(loop);
-    acceptor.async_accept(asocket, [](auto){});
-
-    ip::tcp::socket csocket(loop);
-    csocket.connect(ip::tcp::endpoint(ip::address_v4::loopback(), 2222));
-    csocket.set_option(socket_base::send_buffer_size(1u << 20));
-    //csocket.set_option(socket_base::send_low_watermark(1u << 12));
-    int lowat = 4096;
-    if (setsockopt(csocket.native(), IPPROTO_TCP, TCP_NOTSENT_LOWAT, (const char*)&lowat, sizeof(lowat)))
+    pin_me(opt.sender_cpu);
+    ufw::pacer pace(opt.rate);
+    for (size_t i = 0; i < opt.warmup + opt.count; ++i)
     {
-        std::clog << "oh no!" << std::endl;
+        loop.post([&lat, &opt, i, then = time_of(pace.wait(i))]
+        {
+            auto const now = clock::now();
+            if (i >= opt.warmup)
+                lat.push_back(to_us(now - then));
+        });
     }
 
-//     // this tests the latency to post a functor to the loop
-//     auto fn = loop.wrap([&](auto then)
-//     {
-//         acc(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - then).count());
-//     });
+    work.reset();
+    thread.join();
+    report("post", opt, lat, pace);
+}
+
+/** same as above with the busy-polling reactor and its ringbuf submission channel */
+void probe_post(ufw::reactor<>& loop, options const& opt)
+{
+    std::vector<double> lat;
+    lat.reserve(opt.count);
 
-    // this tests the writability check latency
-    auto fn = loop.wrap([&]
+    std::thread thread([&]
+    {
+        pin_me(opt.receiver_cpu);
+        loop.run();
+    });
+
+    pin_me(opt.sender_cpu);
+    auto& channel = loop.attach();
+    ufw::pacer pace(opt.rate);
+    for (size_t i = 0; i < opt.warmup + opt.count; ++i)
     {
-        csocket.async_write_some(null_buffers(), [&, then = clock::now()](auto, auto)
+        channel.post([&lat, &opt, i, then = time_of(pace.wait(i))]
         {
-            acc(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - then).count());
+            auto const now = clock::now();
+            if (i >= opt.warmup)
+                lat.push_back(to_us(now - then));
         });
+    }
+
+    channel.post([&loop] { loop.stop(); });
+    thread.join();
+    report("post", opt, lat, pace);
+}
+
+/** latency of an async writability check on a connected socket, posted to the io_service thread */
+template <class Protocol>
+void probe_writable(io_service& loop, connection<Protocol>& conn, options const& opt)
+{
+    std::vector<double> lat;
+    lat.reserve(opt.count);
+
+    auto work = std::make_unique<io_service::work>(loop);
+    std::thread thread([&]
+    {
+        pin_me(opt.receiver_cpu);
+        loop.run();
     });
 
-    for (size_t i = 0; i < 10'000; ++i)
+    pin_me(opt.sender_cpu);
+    ufw::pacer pace(opt.rate);
+    for (size_t i = 0; i < opt.warmup + opt.count; ++i)
     {
-        using namespace std::literals;
-        std::this_thread::sleep_for(10us);
-        //fn(clock::now()); 
-        fn();
+        pace.wait(i);
+        loop.post([&lat, &opt, &conn, i]
+        {
+            conn.tx.async_send(null_buffers(), [&lat, &opt, i, then = clock::now()](auto, auto)
+            {
+                auto const now = clock::now();
+                if (i >= opt.warmup)
+                    lat.push_back(to_us(now - then));
+            });
+        });
     }
 
     work.reset();
-    if (thread.joinable())
-        thread.join();
+    thread.join();
+    report("writable", opt, lat, pace);
+}
+
+template <class Protocol>
+void run(io_service& loop, connection<Protocol> conn, options const& opt, bool stream)
+{
+    tune(conn.tx, opt);
+    tune(conn.rx, opt);
+
+    if (opt.probe == "oneway" && opt.io == "framed")
+        probe_oneway_framed(conn, opt, stream);
+    else if (opt.probe == "oneway" && opt.io == "mmsg")
+        probe_oneway_mmsg(conn, opt);
+    else if (opt.probe == "oneway" && opt.io != "sync")
+        probe_oneway_uring(conn, opt, stream);
+    else if (opt.probe == "oneway")
+        probe_oneway(conn, opt, stream);
+    else if (opt.probe == "oneway-batched")
+        probe_oneway_batched(conn, opt);
+    else if (opt.probe == "rtt")
+        probe_rtt(conn, opt, stream);
+    else if (opt.probe == "writable")
+        probe_writable(loop, conn, opt);
+    else
+        throw std::invalid_argument("unknown probe: " + opt.probe);
+}
+
+void run(options const& opt)
+{
+    io_service loop;
+
+    if (opt.probe == "post" && opt.loop == "reactor")
+    {
+        ufw::reactor<> reactor;
+        probe_post(reactor, opt);
+    }
+    else if (opt.probe == "post")
+        probe_post(loop, opt);
+    else if (opt.transport == "tcp")
+        run(loop, connect_tcp(loop, opt), opt, true);
+    else if (opt.transport == "udp")
+        run(loop, connect_udp(loop, opt), opt, false);
+    else if (opt.transport == "unix")
+        run(loop, connect_unix(loop, opt), opt, true);
+    else
+        throw std::invalid_argument("unknown transport: " + opt.transport);
+}
+
+} // local namespace
+
+// g++ @flags.txt -o quiet quiet.cc
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
 
-    std::atomic_thread_fence(std::memory_order_acquire);
+    options opt;
+    po::options_description desc("loopback latency probes");
+    desc.add_options()
+        ("help,h", "this message")
+        ("probe,p", po::value(&opt.probe)->default_value("oneway"), "oneway | oneway-batched | rtt | post | writable")
+        ("transport,t", po::value(&opt.transport)->default_value("tcp"), "tcp | udp | unix")
+        ("loop,l", po::value(&opt.loop)->default_value("asio"), "asio | reactor, event loop of the post probe")
+        ("io", po::value(&opt.io)->default_value("sync"), "sync | uring | posix | mmsg (udp) | framed (tcp/unix), socket I/O of the oneway probe")
+        ("size,s", po::value(&opt.size)->default_value(64), "message size, bytes")
+        ("count,n", po::value(&opt.count)->default_value(100'000), "number of measured messages")
+        ("warmup,w", po::value(&opt.warmup)->default_value(1'000), "number of messages before measuring")
+        ("rate,r", po::value(&opt.rate)->default_value(100'000), "messages/sec on an open loop schedule, 0 - back to back")
+        ("sweep", po::value(&opt.sweep)->multitoken(), "rates to run the probe at in turn, prints the latency-throughput curve")
+        ("port", po::value(&opt.port)->default_value(2222), "tcp/udp port on the loopback")
+        ("path", po::value(&opt.path)->default_value("/tmp/quiet.sock"), "unix socket path")
+        ("nodelay", po::value(&opt.nodelay)->default_value(true), "TCP_NODELAY")
+        ("notsent-lowat", po::value(&opt.notsent_lowat)->default_value(0), "TCP_NOTSENT_LOWAT, bytes, 0 - system default")
+        ("sndbuf", po::value(&opt.sndbuf)->default_value(0), "SO_SNDBUF, bytes, 0 - system default")
+        ("rcvbuf", po::value(&opt.rcvbuf)->default_value(0), "SO_RCVBUF, bytes, 0 - system default")
+        ("sender-cpu", po::value(&opt.sender_cpu)->default_value(-1), "pin the sending thread")
+        ("receiver-cpu", po::value(&opt.receiver_cpu)->default_value(-1), "pin the receiving/loop thread");
 
-    std::clog << "min: " << min(acc) << " us" << std::endl;
-    std::clog << "max: " << max(acc) << " us" << std::endl;
-    std::clog << "mean: " << mean(acc) << " us" << std::endl;
-    std::clog << "var:  " << variance(acc) << " us" << std::endl;
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    opt.size = std::max(opt.size, STAMP_SIZE);
+
+    clock::scale();
+
+    if (opt.sweep.empty())
+        opt.sweep.push_back(opt.rate);
+
+    for (auto const rate: opt.sweep)
+    {
+        opt.rate = rate;
+        run(opt);
+    }
+
+    if (curve.size() > 1)
+    {
+        std::clog << "\nlatency vs offered load, us\n"
+                  << std::setw(12) << "rate/sec" << std::setw(12) << "p50" << std::setw(12) << "p99"
+                  << std::setw(12) << "p99.9" << std::setw(12) << "max" << std::setw(10) << "late" << '\n';
+        for (auto const& x: curve)
+            std::clog << std::setw(12) << std::setprecision(0) << x.rate << std::setprecision(3)
+                      << std::setw(12) << x.p50 << std::setw(12) << x.p99 << std::setw(12) << x.p999
+                      << std::setw(12) << x.max << std::setw(10) << x.late << '\n';
+        std::clog << std::flush;
+    }
 
     return 0;
 }
@@ -0,0 +1,282 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "../ringbuf/ringbuf.h"
+#include "../ringbuf/tsc_clock.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace ufw {
+
+/**
+ * Nullary callable stored in place, no heap, no refcounting.
+ * The closure must be trivially copyable and destructible, which covers
+ * lambdas capturing pointers, references and plain values.
+ */
+template <size_t SIZE = 48>
+struct inplace_task
+{
+    inplace_task() = default;
+
+    template <class F, class = std::enable_if_t<!std::is_same<std::decay_t<F>, inplace_task>::value>>
+    inplace_task(F&& f) noexcept: call_(&invoke<std::decay_t<F>>)
+    {
+        using func_t = std::decay_t<F>;
+        static_assert(sizeof(func_t) <= SIZE, "closure too big");
+        static_assert(std::is_trivially_copyable<func_t>::value && std::is_trivially_destructible<func_t>::value,
+                      "closure must be trivially copyable");
+        new(&storage_) func_t(std::forward<F>(f));
+    }
+
+    void operator()() { call_(&storage_); }
+
+private:
+    template <class F>
+    static void invoke(void* f) { (*static_cast<F*>(f))(); }
+
+    void (*call_)(void*) = nullptr;
+    std::aligned_storage_t<SIZE, alignof(std::max_align_t)> storage_;
+};
+
+/**
+ * Busy-polling epoll reactor for a dedicated thread.
+ *
+ * Each poll drains the submission channels, then collects the ready descriptors
+ * with a zero timeout epoll_wait. Other threads submit work through their own
+ * channel, an SPSC ringbuf, so posting is a single release store, no lock and
+ * no syscall while the reactor is spinning. After spin_limit idle polls the
+ * reactor parks in a blocking epoll_wait, the producers then ring an eventfd.
+ *
+ * @tparam CAP capacity of each submission channel
+ * @tparam MAX_CHANNELS maximum number of submitting threads
+ */
+template <size_t CAP = 1024, size_t MAX_CHANNELS = 16>
+class reactor
+{
+public:
+    using task_t = inplace_task<>;
+    using handler_t = std::function<void(uint32_t /* epoll events */)>;
+
+    /** submission queue of one producer thread */
+    class channel
+    {
+        friend class reactor;
+
+        reactor& owner_;
+        ringbuf<task_t, CAP> ring_;
+
+        explicit channel(reactor& owner): owner_(owner) {}
+
+    public:
+        /** spins while the channel is full */
+        template <class F>
+        void post(F&& f) noexcept
+        {
+            while (!ring_.put(task_t(std::forward<F>(f))))
+                zzz();
+            owner_.notify();
+        }
+    };
+
+    /**
+     * @param spin_limit number of consecutive idle polls before parking, 0 - never park
+     * @param park_timeout_ms upper bound of a single park
+     */
+    explicit reactor(size_t spin_limit = 1u << 16, int park_timeout_ms = 100):
+        spin_limit_(spin_limit), park_timeout_ms_(park_timeout_ms),
+        epfd_(::epoll_create1(EPOLL_CLOEXEC)), wakefd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    {
+        if (epfd_ < 0 || wakefd_ < 0)
+            throw std::system_error(errno, std::system_category(), "reactor");
+
+        epoll_event ev {};
+        ev.events = EPOLLIN;
+        ev.data.fd = wakefd_;
+        ::epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev);
+    }
+
+    ~reactor()
+    {
+        ::close(wakefd_);
+        ::close(epfd_);
+    }
+
+    reactor(reactor const&) = delete;
+    reactor& operator=(reactor const&) = delete;
+
+    /** a new submission channel for the calling thread, any thread */
+    channel& attach()
+    {
+        auto const n = attached_.fetch_add(1, std::memory_order_relaxed);
+        if (n >= MAX_CHANNELS)
+            throw std::length_error("reactor: too many channels");
+        channels_[n].reset(new channel(*this));
+        published_[n].store(true, std::memory_order_release);
+        return *channels_[n];
+    }
+
+    /** reactor thread only */
+    void add(int fd, uint32_t events, handler_t handler)
+    {
+        auto& h = handlers_[fd];
+        h.reset(new handler_t(std::move(handler)));
+        epoll_event ev {};
+        ev.events = events;
+        ev.data.fd = fd;
+        if (::epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev))
+            throw std::system_error(errno, std::system_category(), "epoll_ctl");
+    }
+
+    /**
+     * Reactor thread only, handlers included: the events of fd still pending
+     * in the current dispatch are dropped, the handler is freed after it.
+     */
+    void remove(int fd)
+    {
+        ::epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+        auto const it = handlers_.find(fd);
+        if (it == handlers_.end())
+            return;
+        retired_.push_back(std::move(it->second)); // may be the one running
+        handlers_.erase(it);
+    }
+
+    /**
+     * One non-blocking iteration: submitted tasks first, then ready descriptors.
+     * @return number of tasks and events handled
+     */
+    size_t poll() { return drain() + dispatch(0); }
+
+    /** polls until stop(), parking when idle */
+    void run()
+    {
+        size_t idle = 0;
+        while (!stopped_.load(std::memory_order_relaxed))
+        {
+            if (poll())
+                idle = 0;
+            else if (spin_limit_ && ++idle >= spin_limit_)
+            {
+                park();
+                idle = 0;
+            }
+            else
+                zzz();
+        }
+        drain();
+    }
+
+    /** any thread */
+    void stop() noexcept
+    {
+        stopped_.store(true, std::memory_order_relaxed);
+        wake();
+    }
+
+private:
+    size_t drain() noexcept
+    {
+        size_t done = 0;
+        for (size_t i = 0, n = std::min(MAX_CHANNELS, attached_.load(std::memory_order_relaxed)); i < n; ++i)
+        {
+            if (!published_[i].load(std::memory_order_acquire))
+                continue;
+            auto& ring = channels_[i]->ring_;
+            while (ring.take([](task_t&& task) noexcept { task(); }))
+                ++done;
+        }
+        return done;
+    }
+
+    size_t dispatch(int timeout_ms)
+    {
+        auto const n = ::epoll_wait(epfd_, events_.data(), events_.size(), timeout_ms);
+        for (int i = 0; i < n; ++i)
+        {
+            auto const fd = events_[i].data.fd;
+            if (fd == wakefd_)
+            {
+                uint64_t x;
+                while (::read(wakefd_, &x, sizeof(x)) > 0);
+            }
+            else if (auto const it = handlers_.find(fd); it != handlers_.end())
+                (*it->second)(events_[i].events);
+        }
+        retired_.clear();
+        return n > 0 ? n : 0;
+    }
+
+    void park()
+    {
+        sleeping_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // re-check after announcing, a producer may have missed the flag
+        if (!drain() && !stopped_.load(std::memory_order_relaxed))
+            dispatch(park_timeout_ms_);
+
+        sleeping_.store(false, std::memory_order_relaxed);
+    }
+
+    void notify() noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_relaxed))
+            wake();
+    }
+
+    void wake() noexcept
+    {
+        uint64_t const one = 1;
+        auto rc = ::write(wakefd_, &one, sizeof(one));
+        (void)rc;
+    }
+
+    size_t const spin_limit_;
+    int const park_timeout_ms_;
+
+    int const epfd_;
+    int const wakefd_;
+
+    std::array<epoll_event, 64> events_;
+    std::unordered_map<int, std::unique_ptr<handler_t>> handlers_;
+    std::vector<std::unique_ptr<handler_t>> retired_; // removed, freed at the end of a dispatch
+
+    std::array<std::unique_ptr<channel>, MAX_CHANNELS> channels_;
+    std::array<std::atomic<bool>, MAX_CHANNELS> published_ {};
+    std::atomic<size_t> attached_ {0};
+
+    alignas(UFW_L1D_LINE_SIZE) std::atomic<bool> sleeping_ {false};
+    std::atomic<bool> stopped_ {false};
+};
+
+} // namespace ufw
@@ -0,0 +1,242 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "../ringbuf/ringbuf.h"
+#include "../ringbuf/tsc_clock.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+namespace ufw {
+
+/** fixed capacity outbound message, the session_writer queue element */
+template <size_t N>
+struct out_message
+{
+    static constexpr size_t CAPACITY = N;
+
+    /** bytes at most CAPACITY, a longer message is cut short */
+    out_message(char const* data, size_t bytes) noexcept: len(uint32_t(std::min(bytes, N)))
+    {
+        assert(bytes <= N);
+        std::memcpy(buf, data, len);
+    }
+
+    uint32_t len;
+    char buf[N];
+
+    char const* data() const noexcept { return buf; }
+    size_t size() const noexcept { return len; }
+};
+
+/**
+ * Coalescing TCP session writer.
+ *
+ * Messages are queued by a producer thread in an SPSC ringbuf and written by the
+ * network thread with one writev() per batch, straight from the ring slots. With
+ * TCP_NOTSENT_LOWAT the kernel holds at most about notsent_lowat bytes not yet sent:
+ * flush() stops once that much is unsent and resumes on the next writability event,
+ * so the backlog stays in user space where a message can still be dropped or updated
+ * by the filter right before it is handed to the kernel.
+ *
+ * @tparam T message type with data() and size(), e.g. out_message
+ * @tparam CAP queue capacity
+ * @tparam BATCH maximum number of messages per writev()
+ */
+template <class T, size_t CAP = 1024, size_t BATCH = 64>
+class session_writer
+{
+    static_assert(BATCH > 0 && BATCH <= IOV_MAX && BATCH < CAP, "");
+
+public:
+    using queue_t = ringbuf<T, CAP>;
+
+    /**
+     * Switches the socket to non-blocking mode and sets TCP_NOTSENT_LOWAT.
+     * The network thread should watch it for EPOLLOUT while blocked().
+     */
+    session_writer(int fd, int notsent_lowat = 4096): fd_(fd), lowat_(notsent_lowat)
+    {
+        if (::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) | O_NONBLOCK) ||
+            ::setsockopt(fd_, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat_, sizeof(lowat_)))
+        {
+            throw std::system_error(errno, std::system_category(), "session_writer");
+        }
+    }
+
+    /** producer side */
+    queue_t& queue() noexcept { return queue_; }
+
+    /** producer side, constructs a T from args in the queue, spins while the queue is full */
+    template <class... Args>
+    void post(Args&&... args) noexcept
+    {
+        while (!queue_.put(args...))
+            zzz();
+    }
+
+    /**
+     * Writes queued messages while the kernel has less than notsent_lowat bytes unsent.
+     * The unsent bytes are queried once per call, at most the difference is written
+     * (give or take a message), then the writer is blocked() until the next writability event.
+     * Filter signature: bool(T&), called once per message, when it is first about to be written,
+     * false drops it. The verdict is kept until the message leaves the queue, a dropped message
+     * is destroyed at once and never written. The slots go back to the producer in queue order,
+     * a message once completely written, a dropped one along with the messages ahead of it.
+     * @return number of bytes written, -1 on a socket error (see error())
+     */
+    template <class Filter>
+    ssize_t flush(Filter&& keep) noexcept
+    {
+        int unsent = 0;
+        if (::ioctl(fd_, SIOCOUTQNSD, &unsent) == 0 && unsent >= lowat_)
+        {
+            blocked_ = true;
+            return 0;
+        }
+
+        blocked_ = false;
+        size_t const budget = lowat_ - unsent;
+        ssize_t total = 0;
+        for (;;)
+        {
+            // called twice when the queue wraps around, the second span gets what is left of the budget
+            ssize_t written = 0;
+            auto const done = queue_.template invokep<false, BATCH>([&](auto* nodes, size_t len) noexcept
+            {
+                if (size_t(total + written) >= budget)
+                    return size_t(0);
+                return write(reinterpret_cast<T*>(nodes), len, budget - total - written, keep, written);
+            });
+
+            if (written < 0)
+                return -1;
+            total += written;
+            if (blocked_ || (!done && !written))
+                break;
+            if (size_t(total) >= budget)
+            {
+                blocked_ = true;
+                break;
+            }
+        }
+        return total;
+    }
+
+    ssize_t flush() noexcept { return flush([](T&) noexcept { return true; }); }
+
+    /** the kernel has enough unsent data, wait for writability before the next flush() */
+    bool blocked() const noexcept { return blocked_; }
+
+    int error() const noexcept { return error_; }
+
+    size_t syscalls() const noexcept { return syscalls_; }
+    size_t messages() const noexcept { return messages_; }
+
+private:
+    template <class Filter>
+    /** writes from the head of msgs, adds the bytes to written, returns the number of messages released */
+    size_t write(T* msgs, size_t len, size_t budget, Filter& keep, ssize_t& written) noexcept
+    {
+        std::array<iovec, BATCH> iov;
+        std::array<size_t, BATCH> sizes; // 0 - dropped
+        size_t iovcnt = 0, bytes = 0, n = 0;
+
+        for (; n < len && (!bytes || bytes < budget); ++n)
+        {
+            auto& msg = msgs[n];
+            if (n == filtered_ && !(kept_[filtered_++] = keep(msg)))
+                msg.~T();
+            if (!kept_[n])
+            {
+                sizes[n] = 0;
+                continue;
+            }
+            auto const offset = n ? 0 : offset_;
+            sizes[n] = msg.size() - offset;
+            iov[iovcnt++] = {const_cast<char*>(msg.data()) + offset, sizes[n]};
+            bytes += sizes[n];
+        }
+
+        auto sent = iovcnt ? ::writev(fd_, iov.data(), iovcnt) : 0;
+        syscalls_ += !!iovcnt;
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                blocked_ = true;
+            else
+            {
+                error_ = errno;
+                written = -1;
+            }
+            return 0;
+        }
+        written += sent;
+
+        // release completely written and dropped messages
+        size_t done = 0;
+        for (; done < n; ++done)
+        {
+            if (size_t(sent) < sizes[done])
+            {
+                offset_ += sent;
+                break;
+            }
+            sent -= sizes[done];
+            offset_ = 0;
+            if (kept_[done])
+            {
+                ++messages_;
+                msgs[done].~T();
+            }
+        }
+        std::copy(kept_.begin() + done, kept_.begin() + filtered_, kept_.begin());
+        filtered_ -= done;
+
+        blocked_ |= done < n;
+        return done;
+    }
+
+    int const fd_;
+    int const lowat_;
+
+    size_t offset_ = 0; // already written bytes of the first message in the queue
+    size_t filtered_ = 0; // messages from the first in the queue with a filter verdict
+    std::array<bool, BATCH> kept_; // the verdicts
+    bool blocked_ = false;
+    int error_ = 0;
+
+    size_t syscalls_ = 0;
+    size_t messages_ = 0;
+
+    queue_t queue_;
+};
+
+} // namespace ufw
@@ -0,0 +1,196 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "../ringbuf/ringbuf.h"
+#include "../ringbuf/tsc_clock.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <system_error>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace ufw {
+
+/** udp_receiver ring slot, the kernel writes the payload in place */
+template <size_t MAX_SIZE = 1472>
+struct datagram
+{
+    uint64_t tsc;       // rdtsc() right after the datagram was received
+    timespec kernel_ts; // SO_TIMESTAMPNS (CLOCK_REALTIME), zero if not available
+    uint32_t len;       // bytes in payload
+    bool truncated;     // longer than MAX_SIZE, the rest is lost
+    char payload[MAX_SIZE];
+};
+
+/**
+ * UDP socket bound to the port, joined to the group on the interface when the address
+ * is multicast. Throws std::system_error.
+ */
+inline int udp_socket(char const* address, uint16_t port, char const* iface = "0.0.0.0", int rcvbuf = 0)
+{
+    sockaddr_in sa {};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);
+    if (::inet_pton(AF_INET, address, &sa.sin_addr) != 1)
+        throw std::system_error(EINVAL, std::system_category(), address);
+
+    int const fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw std::system_error(errno, std::system_category(), "socket");
+
+    int const one = 1;
+    bool ok = !::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) &&
+              (rcvbuf <= 0 || !::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf))) &&
+              !::bind(fd, reinterpret_cast<sockaddr const*>(&sa), sizeof(sa));
+
+    if (ok && IN_MULTICAST(ntohl(sa.sin_addr.s_addr)))
+    {
+        ip_mreq mreq {};
+        mreq.imr_multiaddr = sa.sin_addr;
+        ok = ::inet_pton(AF_INET, iface, &mreq.imr_interface) == 1 &&
+             !::setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+
+    if (!ok)
+    {
+        auto const error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::system_category(), "udp_socket");
+    }
+    return fd;
+}
+
+/**
+ * Batched UDP receiver.
+ *
+ * Reserves up to BATCH free slots of an SPSC ringbuf and points the recvmmsg() iovecs
+ * straight at them, the kernel writes every datagram into its final slot. Only the
+ * filled slots are published, the whole batch with one release store, so a consumer
+ * thread sees a datagram per slot with no copy on either side.
+ *
+ * @tparam MAX_SIZE maximum payload size, 1472 is an Ethernet MTU worth of UDP over IPv4
+ * @tparam CAP ring capacity
+ * @tparam BATCH maximum number of datagrams per recvmmsg()
+ */
+template <size_t MAX_SIZE = 1472, size_t CAP = 4096, size_t BATCH = 64>
+class udp_receiver
+{
+    static_assert(BATCH > 0 && BATCH < CAP && BATCH <= 1024 /* UIO_MAXIOV */, "");
+
+public:
+    using slot_t = datagram<MAX_SIZE>;
+    using ring_t = ringbuf<slot_t, CAP>;
+
+    /** enables SO_TIMESTAMPNS on request, throws std::system_error */
+    explicit udp_receiver(int fd, bool kernel_timestamps = true): fd_(fd)
+    {
+        int const on = kernel_timestamps;
+        if (::setsockopt(fd_, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)))
+            throw std::system_error(errno, std::system_category(), "SO_TIMESTAMPNS");
+
+        for (size_t i = 0; i < BATCH; ++i)
+        {
+            auto& hdr = msgs_[i].msg_hdr;
+            hdr.msg_iov = &iov_[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_control = control_[i];
+            iov_[i].iov_len = MAX_SIZE;
+        }
+    }
+
+    /** consumer side */
+    ring_t& ring() noexcept { return ring_; }
+
+    /**
+     * Network thread, never blocks.
+     * @return number of datagrams published, -1 on a socket error (see error())
+     */
+    ssize_t receive() noexcept
+    {
+        bool failed = false;
+        auto const n = ring_.template invokep<true, BATCH>([&](auto* nodes, size_t len) noexcept
+        {
+            return fill(reinterpret_cast<slot_t*>(nodes), len, failed);
+        });
+        datagrams_ += n;
+        return failed && !n ? -1 : ssize_t(n);
+    }
+
+    int error() const noexcept { return error_; }
+
+    size_t syscalls() const noexcept { return syscalls_; }
+    size_t datagrams() const noexcept { return datagrams_; }
+
+private:
+    size_t fill(slot_t* slots, size_t len, bool& failed) noexcept
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            iov_[i].iov_base = slots[i].payload;
+            msgs_[i].msg_hdr.msg_controllen = sizeof(control_[i]);
+        }
+
+        ++syscalls_;
+        auto const n = ::recvmmsg(fd_, msgs_, len, MSG_DONTWAIT, nullptr);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                error_ = errno;
+                failed = true;
+            }
+            return 0;
+        }
+
+        auto const tsc = rdtsc();
+        for (int i = 0; i < n; ++i)
+        {
+            auto& slot = slots[i];
+            auto& hdr = msgs_[i].msg_hdr;
+            slot.tsc = tsc;
+            slot.len = msgs_[i].msg_len;
+            slot.truncated = hdr.msg_flags & MSG_TRUNC;
+            slot.kernel_ts = timespec {};
+            for (auto* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                    std::memcpy(&slot.kernel_ts, CMSG_DATA(cmsg), sizeof(timespec));
+            }
+        }
+        return n;
+    }
+
+    int const fd_;
+    int error_ = 0;
+
+    size_t syscalls_ = 0;
+    size_t datagrams_ = 0;
+
+    mmsghdr msgs_[BATCH] {};
+    iovec iov_[BATCH] {};
+    alignas(cmsghdr) char control_[BATCH][CMSG_SPACE(sizeof(timespec))];
+
+    ring_t ring_;
+};
+
+} // namespace ufw
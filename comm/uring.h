@@ -0,0 +1,662 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "../ringbuf/ringbuf.h"
+#include "../ringbuf/tsc_clock.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace ufw {
+
+namespace details {
+
+inline int io_uring_setup(unsigned entries, io_uring_params* p) noexcept
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+inline int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) noexcept
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+inline int io_uring_register(int fd, unsigned opcode, void const* arg, unsigned nr_args) noexcept
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <class T> inline T load_acquire(T const* p) noexcept { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+template <class T> inline void store_release(T* p, T v) noexcept { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+} // namespace details
+
+/**
+ * Minimal io_uring instance, the kernel interface without liburing.
+ * Single threaded, SQEs are batched locally and handed to the kernel by submit().
+ * Throws std::system_error when the kernel does not support it.
+ */
+class uring
+{
+public:
+    explicit uring(unsigned entries)
+    {
+        io_uring_params p {};
+        fd_ = details::io_uring_setup(entries, &p);
+        if (fd_ < 0)
+            throw std::system_error(errno, std::system_category(), "io_uring_setup");
+
+        sq_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_size_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        sqes_size_ = p.sq_entries * sizeof(io_uring_sqe);
+
+        sq_ptr_ = map(sq_size_, IORING_OFF_SQ_RING);
+        cq_ptr_ = (p.features & IORING_FEAT_SINGLE_MMAP) ? sq_ptr_ : map(cq_size_, IORING_OFF_CQ_RING);
+        sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+
+        auto* sq = static_cast<char*>(sq_ptr_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sq_entries_ = p.sq_entries;
+        auto* sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        for (unsigned i = 0; i < sq_entries_; ++i)
+            sq_array[i] = i; // SQEs are used in ring order
+
+        auto* cq = static_cast<char*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+        sqe_tail_ = *sq_tail_;
+    }
+
+    ~uring()
+    {
+        if (sqes_) ::munmap(sqes_, sqes_size_);
+        if (cq_ptr_ && cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_size_);
+        if (sq_ptr_) ::munmap(sq_ptr_, sq_size_);
+        ::close(fd_);
+    }
+
+    uring(uring const&) = delete;
+    uring& operator=(uring const&) = delete;
+
+    int fd() const noexcept { return fd_; }
+
+    /** a zeroed SQE to fill in, nullptr if the submission queue is full */
+    io_uring_sqe* sqe() noexcept
+    {
+        if (sqe_tail_ - details::load_acquire(sq_head_) >= sq_entries_)
+            return nullptr;
+        auto* sqe = &sqes_[sqe_tail_++ & sq_mask_];
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    /** number of SQEs not yet handed to the kernel */
+    unsigned pending() const noexcept { return sqe_tail_ - *sq_tail_; }
+
+    /**
+     * Publishes the pending SQEs and enters the kernel once,
+     * optionally waiting for wait_nr completions.
+     */
+    int submit(unsigned wait_nr = 0) noexcept
+    {
+        auto const n = pending();
+        details::store_release(sq_tail_, sqe_tail_);
+        if (!n && !wait_nr)
+            return 0;
+        ++syscalls_;
+        return details::io_uring_enter(fd_, n, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    }
+
+    /**
+     * Callback signature: void(io_uring_cqe const&)
+     * @return number of completions consumed
+     */
+    template <class Func>
+    unsigned reap(Func&& func)
+    {
+        auto head = *cq_head_;
+        auto const tail = details::load_acquire(cq_tail_);
+        unsigned n = 0;
+        for (; head != tail; ++head, ++n)
+            func(cqes_[head & cq_mask_]);
+        details::store_release(cq_head_, head);
+        return n;
+    }
+
+    void register_buffers(iovec const* iovs, unsigned n)
+    {
+        if (details::io_uring_register(fd_, IORING_REGISTER_BUFFERS, iovs, n) < 0)
+            throw std::system_error(errno, std::system_category(), "IORING_REGISTER_BUFFERS");
+    }
+
+    void register_files(int const* fds, unsigned n)
+    {
+        if (details::io_uring_register(fd_, IORING_REGISTER_FILES, fds, n) < 0)
+            throw std::system_error(errno, std::system_category(), "IORING_REGISTER_FILES");
+    }
+
+    size_t syscalls() const noexcept { return syscalls_; }
+
+private:
+    void* map(size_t size, off_t offset)
+    {
+        auto* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, offset);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::system_category(), "io_uring mmap");
+        return p;
+    }
+
+    int fd_;
+
+    void* sq_ptr_ = nullptr;
+    void* cq_ptr_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sq_size_, cq_size_, sqes_size_;
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned sqe_tail_;
+
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+
+    size_t syscalls_ = 0;
+};
+
+/** a received chunk (stream) or datagram, owned by the consumer until released */
+struct rx_event
+{
+    uint8_t const* data;
+    uint32_t len;
+    uint16_t bid;
+};
+
+/**
+ * Socket transport on io_uring.
+ *
+ * Receives: a single multishot recv into a kernel-provided buffer ring, each completion
+ * is published as an rx_event to an SPSC ringbuf consumed by another thread, which
+ * returns the buffer with release() through a second ringbuf, no copies.
+ * Sends: copied into a registered buffer and written with WRITE_FIXED on a registered
+ * file, all the sends queued between two poll() calls go in with one io_uring_enter().
+ * Concurrent writes to a socket may complete out of order, so a stream has one write
+ * in flight, and the datagrams of a poll() go as one linked chain, the next chain
+ * waits for the previous one to complete.
+ *
+ * When io_uring or the provided buffer rings are not available (kernels before 6.0,
+ * seccomp-ed containers) it falls back to non-blocking recv()/send().
+ *
+ * @tparam RX_CAP capacity of the receive and release rings, also the upper bound of rx buffers
+ */
+template <size_t RX_CAP = 1024>
+class uring_transport
+{
+    static constexpr uint64_t RECV_TAG = 1ull << 48;
+    static constexpr uint64_t SEND_TAG = 2ull << 48;
+    static constexpr uint64_t CANCEL_TAG = 3ull << 48;
+    static constexpr uint16_t BGID = 0;
+    static constexpr uint16_t NO_BUFFER = 0xffff; // bid of an empty datagram received with io_uring
+
+public:
+    enum class backend { URING, POSIX };
+
+    /**
+     * @param fd connected socket, switched to non-blocking mode by the fallback,
+     *        io_uring would fail the writes with EAGAIN instead of polling
+     * @param stream true for TCP, false for UDP
+     * @param rx_buffers number of receive buffers, power of 2 below RX_CAP
+     * @param rx_buffer_size size of each, the maximum datagram size
+     * @param tx_bytes send buffer, split into rx_buffer_size slots for datagrams
+     */
+    uring_transport(int fd, bool stream, unsigned rx_buffers = 256, unsigned rx_buffer_size = 2048,
+                    size_t tx_bytes = 1u << 20, backend preferred = backend::URING):
+        fd_(fd), stream_(stream), rx_buffers_(rx_buffers), rx_buffer_size_(rx_buffer_size), tx_bytes_(tx_bytes),
+        rx_pool_(size_t(rx_buffers) * rx_buffer_size), tx_pool_(tx_bytes)
+    {
+        if (rx_buffers >= RX_CAP || (rx_buffers & (rx_buffers - 1)))
+            throw std::invalid_argument("uring_transport: rx_buffers must be a power of 2 below RX_CAP");
+
+        if (!stream_)
+            for (size_t slot = tx_bytes_ / rx_buffer_size_; slot--;)
+                tx_slots_.push_back(slot);
+
+        if (preferred == backend::URING)
+        {
+            try { setup_uring(); }
+            catch (std::system_error const&) { teardown_uring(); }
+        }
+
+        if (!ring_)
+            fallback();
+    }
+
+    ~uring_transport()
+    {
+        // the kernel must be done with the receive buffers before they are freed
+        if (ring_ && recv_armed_)
+        {
+            if (auto* sqe = ring_->sqe())
+            {
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = RECV_TAG;
+                sqe->user_data = CANCEL_TAG;
+                while (recv_armed_ && ring_->submit(1) >= 0)
+                    ring_->reap([this](io_uring_cqe const& cqe) noexcept
+                    {
+                        if (cqe.user_data == RECV_TAG && !(cqe.flags & IORING_CQE_F_MORE))
+                            recv_armed_ = false;
+                    });
+            }
+        }
+        teardown_uring();
+    }
+
+    backend mode() const noexcept { return ring_ ? backend::URING : backend::POSIX; }
+
+    /** network thread, false if the send buffer is full */
+    bool send(void const* data, size_t len) noexcept
+    {
+        if (!ring_)
+            return send_posix(data, len);
+
+        if (stream_)
+        {
+            if (tx_tail_ - tx_head_ + len > tx_bytes_)
+                return false;
+            auto const at = tx_tail_ % tx_bytes_;
+            auto const first = std::min(len, tx_bytes_ - at);
+            std::memcpy(&tx_pool_[at], data, first);
+            std::memcpy(&tx_pool_[0], static_cast<char const*>(data) + first, len - first);
+            tx_tail_ += len;
+            return true;
+        }
+
+        if (tx_slots_.empty() || len > rx_buffer_size_)
+            return false;
+        auto const slot = tx_slots_.back();
+        tx_slots_.pop_back();
+        std::memcpy(&tx_pool_[slot * rx_buffer_size_], data, len);
+        tx_staged_.push_back({slot, len});
+        return true;
+    }
+
+    /**
+     * Network thread: recycles released buffers, submits the queued sends,
+     * publishes the completed receives to rx().
+     * @return number of completions handled
+     */
+    size_t poll() noexcept
+    {
+        recycle();
+        if (!ring_)
+            return poll_posix();
+
+        if (rearm_)
+            arm_recv();
+
+        if (!tx_inflight_ && !unsupported_)
+            stream_ ? write_stream() : write_datagrams();
+
+        ring_->submit();
+
+        auto const n = ring_->reap([this](io_uring_cqe const& cqe) noexcept
+        {
+            if (cqe.user_data == RECV_TAG)
+                on_recv(cqe);
+            else
+                on_send(cqe);
+        });
+
+        if (unsupported_ && !tx_inflight_) // the sends in flight complete first
+            fallback();
+        return n;
+    }
+
+    /** consumer side */
+    ringbuf<rx_event, RX_CAP>& rx() noexcept { return rx_; }
+
+    /** consumer side, hands the buffer back to the network thread */
+    void release(uint16_t bid) noexcept
+    {
+        if (bid == NO_BUFFER)
+            return;
+        while (!returns_.put(bid))
+            zzz();
+    }
+
+    bool eof() const noexcept { return eof_; }
+    int error() const noexcept { return error_; }
+
+    size_t syscalls() const noexcept { return ring_ ? ring_->syscalls() : syscalls_; }
+
+private:
+    void setup_uring()
+    {
+        ring_.reset(new uring(RX_CAP));
+
+        iovec const tx {tx_pool_.data(), tx_pool_.size()};
+        ring_->register_buffers(&tx, 1);
+        ring_->register_files(&fd_, 1);
+
+        // provided buffer ring, page aligned
+        buf_ring_size_ = rx_buffers_ * sizeof(io_uring_buf);
+        auto* p = ::mmap(nullptr, buf_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::system_category(), "mmap");
+        buf_ring_ = static_cast<io_uring_buf_ring*>(p);
+
+        io_uring_buf_reg reg {};
+        reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+        reg.ring_entries = rx_buffers_;
+        reg.bgid = BGID;
+        if (details::io_uring_register(ring_->fd(), IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+            throw std::system_error(errno, std::system_category(), "IORING_REGISTER_PBUF_RING");
+
+        for (uint16_t bid = 0; bid < rx_buffers_; ++bid)
+            provide(bid);
+        details::store_release(&buf_ring_->tail, buf_tail_);
+
+        rearm_ = true;
+    }
+
+    void teardown_uring() noexcept
+    {
+        ring_.reset();
+        if (buf_ring_)
+            ::munmap(buf_ring_, buf_ring_size_);
+        buf_ring_ = nullptr;
+    }
+
+    void provide(uint16_t bid) noexcept
+    {
+        // not buf_ring_->bufs, the flexible array wrapper of the uapi header is offset in C++
+        auto& buf = reinterpret_cast<io_uring_buf*>(buf_ring_)[buf_tail_++ & (rx_buffers_ - 1)];
+        buf.addr = reinterpret_cast<uint64_t>(&rx_pool_[size_t(bid) * rx_buffer_size_]);
+        buf.len = rx_buffer_size_;
+        buf.bid = bid;
+    }
+
+    void recycle() noexcept
+    {
+        if (ring_)
+        {
+            auto const before = buf_tail_;
+            while (returns_.take([this](uint16_t bid) noexcept { provide(bid); }));
+            if (buf_tail_ != before)
+            {
+                details::store_release(&buf_ring_->tail, buf_tail_);
+                rearm_ |= starved_;
+                starved_ = false;
+            }
+        }
+        else
+            while (returns_.take([this](uint16_t bid) noexcept { rx_free_.push_back(bid); }));
+    }
+
+    void arm_recv() noexcept
+    {
+        auto* sqe = ring_->sqe();
+        if (!sqe)
+            return;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = 0; // registered file index
+        sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->buf_group = BGID;
+        sqe->user_data = RECV_TAG;
+        rearm_ = false;
+        recv_armed_ = true;
+    }
+
+    void write_stream() noexcept
+    {
+        if (tx_tail_ == tx_head_)
+            return;
+        if (auto* sqe = ring_->sqe())
+        {
+            auto const at = tx_head_ % tx_bytes_;
+            tx_inflight_ = std::min(tx_tail_ - tx_head_, tx_bytes_ - at);
+            prep_write(sqe, &tx_pool_[at], tx_inflight_, SEND_TAG, 0);
+        }
+    }
+
+    void write_datagrams() noexcept
+    {
+        io_uring_sqe* last = nullptr;
+        size_t n = 0;
+        for (; n < tx_staged_.size(); ++n)
+        {
+            auto* sqe = ring_->sqe();
+            if (!sqe)
+                break;
+            auto const& msg = tx_staged_[n];
+            prep_write(sqe, &tx_pool_[msg.slot * rx_buffer_size_], msg.len, SEND_TAG | msg.slot, IOSQE_IO_LINK);
+            last = sqe;
+        }
+        if (last)
+            last->flags &= ~IOSQE_IO_LINK;
+        tx_staged_.erase(tx_staged_.begin(), tx_staged_.begin() + n);
+        tx_inflight_ = n;
+    }
+
+    void prep_write(io_uring_sqe* sqe, char* buf, size_t len, uint64_t tag, uint8_t flags) noexcept
+    {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = 0;
+        sqe->flags = IOSQE_FIXED_FILE | flags;
+        sqe->addr = reinterpret_cast<uint64_t>(buf);
+        sqe->len = static_cast<uint32_t>(len);
+        sqe->buf_index = 0;
+        sqe->user_data = tag;
+    }
+
+    void on_recv(io_uring_cqe const& cqe) noexcept
+    {
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+        {
+            recv_armed_ = false;
+            rearm_ = true;
+        }
+
+        if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER))
+            publish(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT), cqe.res);
+        else if (cqe.res == -ENOBUFS)
+        {
+            // re-armed once the consumer returns buffers
+            rearm_ = false;
+            starved_ = true;
+        }
+        else if (cqe.res == 0 && stream_)
+        {
+            eof_ = true;
+            rearm_ = false;
+        }
+        else if (cqe.res == 0)
+        {
+            // an empty datagram takes no buffer (and ends the multishot), dropped if the consumer
+            // is a whole ring behind
+            ++received_;
+            rx_.put(rx_event {rx_pool_.data(), 0, NO_BUFFER});
+        }
+        else if (cqe.res == -EINVAL && !received_)
+        {
+            // no multishot recv (kernels before 6.0)
+            unsupported_ = true;
+            rearm_ = false;
+        }
+        else if (cqe.res < 0)
+        {
+            error_ = -cqe.res;
+            rearm_ = false;
+        }
+    }
+
+    void on_send(io_uring_cqe const& cqe) noexcept
+    {
+        if (cqe.res < 0 && cqe.res != -ECANCELED /* the rest of a broken chain */)
+            error_ = -cqe.res;
+
+        if (stream_)
+        {
+            tx_head_ += cqe.res > 0 ? cqe.res : 0; // a short write is resubmitted by the next poll()
+            tx_inflight_ = 0;
+        }
+        else
+        {
+            tx_slots_.push_back(cqe.user_data & 0xffff'ffff'ffffull);
+            --tx_inflight_;
+        }
+    }
+
+    /**
+     * Nothing was received yet, all the buffers are free, and no send is in flight.
+     * The queued sends go out with send(), in order, before anything sent after.
+     */
+    void fallback() noexcept
+    {
+        teardown_uring();
+        ::fcntl(fd_, F_SETFL, ::fcntl(fd_, F_GETFL) | O_NONBLOCK);
+        for (uint16_t bid = 0; bid < rx_buffers_; ++bid)
+            rx_free_.push_back(bid);
+
+        while (tx_head_ != tx_tail_)
+        {
+            auto const at = tx_head_ % tx_bytes_;
+            auto const len = std::min(tx_tail_ - tx_head_, tx_bytes_ - at);
+            if (!send_posix(&tx_pool_[at], len))
+                break;
+            tx_head_ += len;
+        }
+        tx_head_ = tx_tail_;
+
+        for (auto const& msg : tx_staged_)
+            send_posix(&tx_pool_[msg.slot * rx_buffer_size_], msg.len);
+        tx_staged_.clear();
+    }
+
+    void publish(uint16_t bid, uint32_t len) noexcept
+    {
+        ++received_;
+        // never full, there are fewer buffers than slots
+        rx_.put(rx_event {&rx_pool_[size_t(bid) * rx_buffer_size_], len, bid});
+    }
+
+    /** recv() until the socket is drained, an empty datagram is published like any other */
+    size_t poll_posix() noexcept
+    {
+        size_t n = 0;
+        while (!rx_free_.empty())
+        {
+            auto const bid = rx_free_.back();
+            ++syscalls_;
+            auto const res = ::recv(fd_, &rx_pool_[size_t(bid) * rx_buffer_size_], rx_buffer_size_, 0);
+            if (res < 0 && errno == EINTR)
+                continue;
+            if (res < 0 || (res == 0 && stream_))
+            {
+                if (res == 0)
+                    eof_ = true;
+                else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    error_ = errno;
+                break;
+            }
+            rx_free_.pop_back();
+            publish(bid, static_cast<uint32_t>(res));
+            ++n;
+        }
+        return n;
+    }
+
+    /** spins on a full socket buffer, the fallback has no user space send queue */
+    bool send_posix(void const* data, size_t len) noexcept
+    {
+        for (size_t sent = 0; sent < len;)
+        {
+            ++syscalls_;
+            auto const n = ::send(fd_, static_cast<char const*>(data) + sent, len - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                error_ = errno;
+                return false;
+            }
+            sent += n > 0 ? n : 0;
+        }
+        return true;
+    }
+
+    int fd_;
+    bool const stream_;
+    unsigned const rx_buffers_;
+    unsigned const rx_buffer_size_;
+    size_t const tx_bytes_;
+
+    std::vector<uint8_t> rx_pool_;
+    std::vector<char> tx_pool_;
+
+    std::unique_ptr<uring> ring_;
+    io_uring_buf_ring* buf_ring_ = nullptr;
+    size_t buf_ring_size_ = 0;
+    uint16_t buf_tail_ = 0;
+    bool rearm_ = false;
+    bool recv_armed_ = false;
+    bool starved_ = false;
+
+    struct staged { size_t slot; size_t len; };
+
+    size_t tx_inflight_ = 0;          // bytes of a stream, datagrams otherwise
+    size_t tx_head_ = 0, tx_tail_ = 0; // stream
+    std::vector<size_t> tx_slots_;     // datagram
+    std::vector<staged> tx_staged_;    // datagram
+
+    std::vector<uint16_t> rx_free_; // posix
+    size_t syscalls_ = 0;           // posix
+
+    size_t received_ = 0;
+    bool unsupported_ = false;
+    bool eof_ = false;
+    int error_ = 0;
+
+    ringbuf<rx_event, RX_CAP> rx_;
+    ringbuf<uint16_t, RX_CAP> returns_;
+};
+
+} // namespace ufw
@@ -1,8 +1,18 @@
 #include "logger.h"
+#include "timer_wheel.h"
+#include "conflation_stats.h"
+#include "../ringbuf/memory_resource.h"
+#include "../ringbuf/tsc_clock.h"
 
 #include <boost/circular_buffer.hpp>
 #include <boost/intrusive/set.hpp>
 
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <memory_resource>
+#include <vector>
+
 /*
    Copyright 2016 Vladimir Lysyy (mrbald@github)
 
@@ -28,7 +38,7 @@ enum class insert_mode: uint8_t
     OVERWRITE = 0, // new element overwrites the existing one
     MERGE,         //
     PUSH,          // new element disables conflation of the existing one,
-                      but itself becomes eligible for future conflation
+                   // but itself becomes eligible for future conflation
     NO_CONFLATION  // conflation disabled
 };
 
@@ -38,16 +48,53 @@ enum class position_mode: uint8_t
     GIVEUP      // merge result enqueued to the back (not optimal for queues with contiguous store)
 };
 
-template <class T, class Cmp = std::less<>>
+/**
+ * Conflating FIFO, a new element replaces a queued one with the same key in place.
+ *
+ * With watermarks set, the key index is only maintained under backpressure: below
+ * the high watermark the buffer is a plain FIFO, once reached it starts conflating
+ * and indexes the already queued elements lazily, a few per put, newest first.
+ * Conflation is switched off again when the depth falls below the low watermark.
+ *
+ * Stats is either no_conflation_stats or conflation_stats<T, K, Cmp>.
+ */
+template <class T, class Cmp = std::less<>, class Stats = no_conflation_stats>
 struct sorted_circular_buffer
 {
-    sorted_circular_buffer(size_t cap): ring(cap) {}
+    /**
+     * @param cap initial capacity, doubles when exceeded
+     * @param low_watermark conflation is switched off below this depth
+     * @param high_watermark conflation is switched on at this depth, by default always on
+     * @param resource backs the ring, e.g. a pool_resource from memory_resource.h, or this_thread_resource()
+     *        when the buffer is used from the constructing thread only
+     */
+    sorted_circular_buffer(size_t cap, size_t low_watermark = 0, size_t high_watermark = 0,
+                           std::pmr::memory_resource* resource = std::pmr::get_default_resource()):
+        ring(cap, typename ring_t::allocator_type(resource)), low_watermark(low_watermark), high_watermark(std::max(low_watermark, high_watermark)),
+        indexing(!this->high_watermark) {}
 
     template <class X>
     bool put(X&& x)
     {
         if (ring.full())
+        {
             ring.set_capacity(ring.capacity() * 2);
+            unindexed = ring.size(); // relocated nodes come out unlinked
+        }
+
+        if (!indexing)
+        {
+            if (ring.size() < high_watermark)
+            {
+                ring.push_back(node{std::forward<X>(x)});
+                stats.on_put(ring.back().data, false, ring.size());
+                return true;
+            }
+            indexing = true;
+            unindexed = ring.size();
+        }
+
+        reindex();
 
         // TODO: VL: key extractor, etc.
         typename tree_t::insert_commit_data commit_data;
@@ -56,11 +103,13 @@ struct sorted_circular_buffer
         {
             ring.push_back(node{std::forward<X>(x)});
             tree.insert_commit(ring.back(), commit_data);
+            stats.on_put(ring.back().data, false, ring.size());
             return true;
         }
         else
         {
             res.first->data = std::forward<X>(x); // TODO: VL: merging policy
+            stats.on_put(res.first->data, true, ring.size());
             return false;
         }
     }
@@ -71,15 +120,30 @@ struct sorted_circular_buffer
             return false;
         t = std::move(ring.front().data);
         ring.pop_front();
+        unindexed -= !!unindexed;
+        stats.on_take(ring.size());
+
+        if (indexing && ring.size() < low_watermark)
+        {
+            indexing = false;
+            unindexed = 0;
+            tree.clear();
+        }
         return true;
     }
 
+    size_t size() const noexcept { return ring.size(); }
+
+    bool conflating() const noexcept { return indexing; }
+
+    Stats& statistics() noexcept { return stats; }
+
 private:
     struct node: ive::set_base_hook<ive::link_mode<ive::auto_unlink>, ive::optimize_size<false>>
     {
         T data;
-        template <class... Args>
-        node(Args&&... args): data(std::forward<Args>(args)...) {}
+        node(T const& data): data(data) {}
+        node(T&& data): data(std::move(data)) {}
     };
 
     struct CmpAdapter
@@ -90,24 +154,271 @@ private:
         bool operator()(node const& l, T const& r) const { return cmp(l.data, r); }
     };
 
-    using ring_t = boost::circular_buffer<node>;
+    using ring_t = boost::circular_buffer<node, std::pmr::polymorphic_allocator<node>>;
     ring_t ring;
 
     using tree_t = ive::set<node, ive::compare<CmpAdapter>, ive::constant_time_size<false>>;
     tree_t tree;
+
+    size_t const low_watermark;
+    size_t const high_watermark;
+
+    bool indexing;
+    size_t unindexed = 0; // number of elements at the front not yet in the index
+
+    static constexpr size_t REINDEX_BATCH = 4;
+
+    Stats stats;
+
+    /** indexes a few of the unindexed elements, newest first, unless a newer one with the same key is there */
+    void reindex()
+    {
+        for (size_t n = 0; unindexed && n < REINDEX_BATCH; ++n)
+        {
+            auto& x = ring[--unindexed];
+            typename tree_t::insert_commit_data commit_data;
+            if (tree.insert_check(x.data, CmpAdapter {}, commit_data).second)
+                tree.insert_commit(x, commit_data);
+        }
+    }
+};
+
+/**
+ * Per-key throttle: each key is emitted at most once per interval, updates arriving
+ * within the interval are conflated and the latest one is emitted when it elapses.
+ * Keys are tracked only while throttled and are retired after a quiet interval.
+ * Expiration is driven by a timer_wheel in TSC ticks, so no per-tick scan of the keys.
+ */
+template <class T, class Cmp = std::less<>>
+struct throttled_circular_buffer
+{
+    /**
+     * @param cap initial capacity of the output queue
+     * @param interval minimum number of TSC ticks between two emissions of a key
+     * @param resolution_shift timer resolution is 2^resolution_shift ticks
+     */
+    throttled_circular_buffer(size_t cap, uint64_t interval, unsigned resolution_shift = 10, uint64_t now = rdtsc()):
+        ring(cap), interval(interval), wheel(now, resolution_shift) {}
+
+    /**
+     * @return true if x is emitted immediately or conflated into a key with nothing pending yet,
+     * false if it overwrote a pending update
+     */
+    template <class X>
+    bool put(X&& x, uint64_t now = rdtsc())
+    {
+        expire(now);
+
+        typename tree_t::insert_commit_data commit_data;
+        auto res = tree.insert_check(x, CmpAdapter {}, commit_data);
+        if (res.second)
+        {
+            auto& k = acquire(std::forward<X>(x));
+            tree.insert_commit(k, commit_data);
+            emit(k.data);
+            wheel.arm(k, now + interval);
+            return true;
+        }
+        else
+        {
+            auto const conflated = res.first->pending;
+            res.first->data = std::forward<X>(x); // the latest update wins
+            res.first->pending = true;
+            return !conflated;
+        }
+    }
+
+    bool take(T& t, uint64_t now = rdtsc())
+    {
+        expire(now);
+        if (ring.empty())
+            return false;
+        t = std::move(ring.front());
+        ring.pop_front();
+        return true;
+    }
+
+    /**
+     * Emits the pending updates of the keys with elapsed intervals.
+     * @return number of keys processed
+     */
+    size_t expire(uint64_t now = rdtsc())
+    {
+        return wheel.advance(now, [this, now](key_state& k)
+        {
+            if (k.pending)
+            {
+                k.pending = false;
+                emit(k.data);
+                wheel.arm(k, now + interval);
+            }
+            else
+                release(k);
+        });
+    }
+
+    size_t size() const noexcept { return ring.size(); }
+
+private:
+    using key_hook = ive::set_base_hook<ive::link_mode<ive::auto_unlink>, ive::optimize_size<false>>;
+
+    struct key_state: timer_wheel_hook, key_hook
+    {
+        T data;
+        bool pending = false;
+        key_state(T const& data): data(data) {}
+        key_state(T&& data): data(std::move(data)) {}
+    };
+
+    struct CmpAdapter
+    {
+        Cmp cmp;
+        bool operator()(key_state const& l, key_state const& r) const { return cmp(l.data, r.data); }
+        bool operator()(T const& l, key_state const& r) const { return cmp(l, r.data); }
+        bool operator()(key_state const& l, T const& r) const { return cmp(l.data, r); }
+    };
+
+    template <class X>
+    key_state& acquire(X&& x)
+    {
+        if (free.empty())
+        {
+            pool.emplace_back(std::forward<X>(x));
+            return pool.back();
+        }
+        auto& k = *free.back();
+        free.pop_back();
+        k.data = std::forward<X>(x);
+        return k;
+    }
+
+    void release(key_state& k)
+    {
+        k.key_hook::unlink();
+        free.push_back(&k);
+    }
+
+    void emit(T const& t)
+    {
+        if (ring.full())
+            ring.set_capacity(ring.capacity() * 2);
+        ring.push_back(t);
+    }
+
+    using ring_t = boost::circular_buffer<T>;
+    ring_t ring;
+
+    uint64_t const interval;
+
+    std::deque<key_state> pool; // stable addresses
+    std::vector<key_state*> free;
+
+    using tree_t = ive::set<key_state, ive::compare<CmpAdapter>, ive::constant_time_size<false>>;
+    tree_t tree;
+
+    timer_wheel<key_state> wheel;
 };
 
 } // namespace ufw
 
 int main()
 {
-    ufw::sorted_circular_buffer<uint64_t> buf(1024);
-
-    buf.put(42ul);
-    buf.put(42ul);
-    uint64_t x;
-    if (buf.take(x))
-        LOG_INF << "popped: " << x;
-    if (buf.take(x))
-        LOG_INF << "popped: " << x;
+    {
+        ufw::sorted_circular_buffer<uint64_t> buf(1024);
+
+        buf.put(42ul);
+        buf.put(42ul);
+        uint64_t x;
+        if (buf.take(x))
+            LOG_INF << "popped: " << x;
+        if (buf.take(x))
+            LOG_INF << "popped: " << x;
+    }
+
+    {
+        ufw::throttled_circular_buffer<uint64_t> buf(1024, 1000, 4, 0);
+        uint64_t x;
+
+        assert(buf.put(42ul, 10));  // emitted
+        assert(buf.put(42ul, 20));  // pending
+        assert(!buf.put(42ul, 30)); // conflated into pending
+        assert(buf.put(43ul, 40));  // another key emitted
+        assert(buf.take(x, 50) && x == 42ul);
+        assert(buf.take(x, 60) && x == 43ul);
+        assert(!buf.take(x, 500));
+        assert(buf.take(x, 1100) && x == 42ul); // pending one released
+        assert(!buf.take(x, 1200));
+        buf.expire(5000);                        // both keys retired
+        assert(buf.put(42ul, 5010));
+        assert(buf.take(x, 5020) && x == 42ul);
+
+        // deadline 5010 + 1000 is not a multiple of the 16 tick resolution,
+        // the pending update must not come out before it
+        assert(buf.put(42ul, 5030));
+        assert(!buf.take(x, 6000) && !buf.take(x, 6009));
+        assert(buf.take(x, 6016) && x == 42ul);
+
+        LOG_INF << "throttle: ok";
+    }
+
+    {
+        ufw::sorted_circular_buffer<uint64_t> buf(4, 2, 4);
+        uint64_t x;
+
+        for (uint64_t i: {1, 1, 2, 3})
+            assert(buf.put(i));   // fifo below the high watermark
+        assert(!buf.conflating());
+        assert(!buf.put(1ul));    // conflated into the newest 1 once indexed
+        assert(buf.conflating() && buf.size() == 4);
+        assert(buf.take(x) && x == 1ul);
+        assert(buf.take(x) && x == 1ul);
+        assert(buf.take(x) && x == 2ul);
+        assert(!buf.conflating()); // below the low watermark
+        assert(buf.put(3ul));
+        assert(buf.take(x) && x == 3ul);
+        assert(buf.take(x) && x == 3ul);
+
+        LOG_INF << "adaptive: ok";
+    }
+
+    {
+        ufw::pool_resource pool;
+        ufw::sorted_circular_buffer<uint64_t> buf(4, 0, 0, &pool);
+        uint64_t x;
+
+        for (uint64_t i = 0; i < 1000; ++i)
+            buf.put(i % 100);   // grows through the pool size classes
+        assert(buf.size() == 100);
+        for (uint64_t i = 0; i < 100; ++i)
+            assert(buf.take(x) && x == i);
+
+        // snapshots are released by their last reader, any thread, hence the shared pool
+        ufw::cow<std::vector<uint64_t>, std::pmr::polymorphic_allocator<std::vector<uint64_t>>> snapshot(&pool);
+        snapshot.store(100, 42ul);
+        assert(snapshot.load()->size() == 100 && snapshot.load()->back() == 42ul);
+
+        LOG_INF << "memory resources: ok";
+    }
+
+    {
+        using stats_t = ufw::conflation_stats<uint64_t, 4>;
+        ufw::sorted_circular_buffer<uint64_t, std::less<>, stats_t> buf(1024);
+
+        for (uint64_t i = 0; i < 1000; ++i)
+            buf.put(i % 10 < 8 ? i % 2 : i);
+        uint64_t x;
+        while (buf.take(x));
+        buf.statistics().publish();
+
+        auto const s = buf.statistics().snapshot();
+        assert(s.puts == 1000 && s.takes == 202 && s.depth == 0 && s.high_watermark == 202);
+        assert(s.hot && s.hot->conflations.size() == 2);
+        assert(s.hot->conflations[0].count == 399 && s.hot->updates.size() == 4);
+        // the heavy keys are exact, the one-off keys evicting each other only bound
+        assert(s.hot->updates[0].count == 400 && s.hot->updates[0].guaranteed() == 400);
+        assert(s.hot->updates[3].count > 1 && s.hot->updates[3].guaranteed() <= 1);
+
+        LOG_INF << "stats: conflation ratio " << s.conflation_ratio()
+                << ", hottest key " << s.hot->conflations[0].key << " with " << s.hot->conflations[0].count << " hits";
+    }
 }
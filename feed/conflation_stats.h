@@ -0,0 +1,231 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "../ringbuf/cow.h"
+
+#include <boost/intrusive/set.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <vector>
+
+namespace ufw {
+
+namespace ive = boost::intrusive;
+
+/**
+ * Space-Saving top-K frequency summary (Metwally, Agrawal, El Abbadi).
+ * The counts are approximate and only the K heaviest keys are kept: a key taking
+ * over an evicted counter inherits its count as the error, so every key in the
+ * summary has guaranteed() = count - error <= true frequency <= count, the overestimate
+ * at most the smallest count. Any key with frequency above N/K is guaranteed to be in it.
+ * Updates are O(log K).
+ */
+template <class T, size_t K, class Cmp = std::less<>>
+struct space_saving
+{
+    struct entry
+    {
+        T key;
+        uint64_t count; // upper bound of the updates of the key
+        uint64_t error; // overestimate bound of count
+
+        /** lower bound of the updates of the key */
+        uint64_t guaranteed() const noexcept { return count - error; }
+    };
+
+    void add(T const& key)
+    {
+        counter* c;
+        auto it = index.find(key, CmpAdapter {});
+        if (it != index.end())
+            c = &*it;
+        else if (used < K)
+        {
+            c = &counters[used];
+            c->rank = used;
+            order[used++] = c;
+            c->key = key;
+            c->count = c->error = 0;
+            index.insert(*c);
+        }
+        else
+        {
+            // evict the minimum, the newcomer inherits its count as the error
+            c = order[K - 1];
+            index.erase(index.iterator_to(*c));
+            c->key = key;
+            c->error = c->count;
+            index.insert(*c);
+        }
+        promote(*c);
+    }
+
+    /** heaviest first */
+    std::vector<entry> top() const
+    {
+        std::vector<entry> res;
+        res.reserve(used);
+        for (size_t i = 0; i < used; ++i)
+            res.push_back({order[i]->key, order[i]->count, order[i]->error});
+        return res;
+    }
+
+private:
+    struct counter: ive::set_base_hook<ive::optimize_size<false>>, entry
+    {
+        size_t rank;
+    };
+
+    struct CmpAdapter
+    {
+        Cmp cmp;
+        bool operator()(counter const& l, counter const& r) const { return cmp(l.key, r.key); }
+        bool operator()(T const& l, counter const& r) const { return cmp(l, r.key); }
+        bool operator()(counter const& l, T const& r) const { return cmp(l.key, r); }
+    };
+
+    /** increments the count, swapping the counter with the first one of its old count to keep the order */
+    void promote(counter& c)
+    {
+        auto const count = c.count++;
+        auto const first = std::lower_bound(order.begin(), order.begin() + c.rank, count,
+                [](counter const* x, uint64_t count) { return x->count > count; });
+        auto& other = **first;
+        std::swap(order[c.rank], *first);
+        std::swap(c.rank, other.rank);
+    }
+
+    std::array<counter, K> counters;
+    std::array<counter*, K> order; // by count, descending
+    size_t used = 0;
+
+    ive::set<counter, ive::compare<CmpAdapter>> index;
+};
+
+/** conflation statistics policy that records nothing */
+struct no_conflation_stats
+{
+    template <class T>
+    void on_put(T const&, bool /* conflated */, size_t /* depth */) noexcept {}
+    void on_take(size_t /* depth */) noexcept {}
+};
+
+/**
+ * Conflation statistics policy: put/take/conflation counters, queue depth and its
+ * high watermark, top-K keys by updates and by conflation hits. The per-key counts
+ * are space_saving approximations of the K heaviest keys, not exact counts of all.
+ *
+ * Written by the buffer owner thread only, snapshot() can be called from any thread:
+ * the counters are relaxed atomics, the hot keys are published through a cow
+ * every publish_period puts.
+ */
+template <class T, size_t K = 16, class Cmp = std::less<>>
+struct conflation_stats
+{
+    using summary_t = space_saving<T, K, Cmp>;
+
+    struct hot_keys
+    {
+        std::vector<typename summary_t::entry> updates;
+        std::vector<typename summary_t::entry> conflations;
+    };
+
+    struct snapshot_t
+    {
+        uint64_t puts;
+        uint64_t conflated;
+        uint64_t takes;
+        size_t depth;
+        size_t high_watermark;
+        std::shared_ptr<hot_keys const> hot; // as of the last publish, can be null
+
+        double conflation_ratio() const noexcept { return puts ? double(conflated) / puts : 0.0; }
+    };
+
+    explicit conflation_stats(uint64_t publish_period = 1u << 12): publish_period(publish_period) {}
+
+    void on_put(T const& key, bool conflated, size_t depth)
+    {
+        bump(puts_);
+        updates.add(key);
+        if (conflated)
+        {
+            bump(conflated_);
+            conflations.add(key);
+        }
+        on_depth(depth);
+
+        if (++since_publish >= publish_period)
+            publish();
+    }
+
+    void on_take(size_t depth) noexcept
+    {
+        bump(takes_);
+        depth_.store(depth, std::memory_order_relaxed);
+    }
+
+    /** owner thread only, makes the current hot keys visible to snapshot() */
+    void publish()
+    {
+        since_publish = 0;
+        hot.store(hot_keys {updates.top(), conflations.top()});
+    }
+
+    snapshot_t snapshot()
+    {
+        return {
+            puts_.load(std::memory_order_relaxed),
+            conflated_.load(std::memory_order_relaxed),
+            takes_.load(std::memory_order_relaxed),
+            depth_.load(std::memory_order_relaxed),
+            high_watermark_.load(std::memory_order_relaxed),
+            hot.load()
+        };
+    }
+
+private:
+    // single writer, no need for a locked RMW
+    template <class X>
+    static void bump(std::atomic<X>& x) noexcept { x.store(x.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+    void on_depth(size_t depth) noexcept
+    {
+        depth_.store(depth, std::memory_order_relaxed);
+        if (depth > high_watermark_.load(std::memory_order_relaxed))
+            high_watermark_.store(depth, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> puts_ {0};
+    std::atomic<uint64_t> conflated_ {0};
+    std::atomic<uint64_t> takes_ {0};
+    std::atomic<size_t> depth_ {0};
+    std::atomic<size_t> high_watermark_ {0};
+
+    summary_t updates;
+    summary_t conflations;
+
+    uint64_t const publish_period;
+    uint64_t since_publish = 0;
+
+    cow<hot_keys> hot;
+};
+
+} // namespace ufw
@@ -0,0 +1,215 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <boost/intrusive/list.hpp>
+
+#include <array>
+#include <cstdint>
+#include <limits>
+
+namespace ufw {
+
+namespace ive = boost::intrusive;
+
+/**
+ * Base for the objects scheduled on a timer_wheel.
+ * Unlinks itself from the wheel when destroyed.
+ */
+struct timer_wheel_hook: ive::list_base_hook<ive::link_mode<ive::auto_unlink>>
+{
+    bool armed() const noexcept { return is_linked(); }
+
+private:
+    template <class, size_t> friend class timer_wheel;
+
+    uint64_t deadline_ {};
+    uint16_t where_ {}; // level * SLOTS + slot
+};
+
+/**
+ * Hierarchical timing wheel (Varghese & Lauck), single threaded.
+ *
+ * Time is measured in TSC ticks and quantized to 2^resolution_shift ticks per wheel step.
+ * Each level has 64 slots, a slot at level L covers 64^L steps, so the horizon is 64^LEVELS steps,
+ * later deadlines are parked in an overflow list and re-scheduled once per horizon.
+ * Arm and cancel are O(1), advance touches only the slots due and skips empty ones with
+ * the per-level occupancy bitmaps, so idle keys are never visited.
+ *
+ * @tparam T timer type, derived from timer_wheel_hook
+ * @tparam LEVELS number of levels
+ */
+template <class T, size_t LEVELS = 4> class timer_wheel
+{
+    static_assert(LEVELS > 0 && 6 * LEVELS < 64, "");
+
+    static constexpr unsigned SLOT_BITS = 6;
+    static constexpr size_t SLOTS = 1u << SLOT_BITS;
+    static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+
+    using slot_t = ive::list<timer_wheel_hook, ive::constant_time_size<false>>;
+
+    std::array<std::array<slot_t, SLOTS>, LEVELS> slots_;
+    std::array<uint64_t, LEVELS> occupied_ {};
+    slot_t overflow_;
+
+    unsigned const shift_;
+    uint64_t now_; // last processed step
+
+    static constexpr unsigned level_shift(size_t level) noexcept { return SLOT_BITS * level; }
+
+    static constexpr uint64_t rotation_mask() noexcept { return (uint64_t(1) << level_shift(LEVELS)) - 1; }
+
+    void place(timer_wheel_hook& t, uint64_t deadline) noexcept
+    {
+        // beyond the current top-level rotation, re-placed when the next one starts
+        if (deadline > (now_ | rotation_mask()))
+        {
+            overflow_.push_back(t);
+            t.where_ = static_cast<uint16_t>(LEVELS * SLOTS);
+            return;
+        }
+
+        // the lowest level at which deadline and now share the enclosing block
+        size_t level = 0;
+        while (level + 1 < LEVELS && (deadline >> level_shift(level + 1)) != (now_ >> level_shift(level + 1)))
+            ++level;
+
+        auto const slot = (deadline >> level_shift(level)) & SLOT_MASK;
+        slots_[level][slot].push_back(t);
+        occupied_[level] |= uint64_t(1) << slot;
+        t.where_ = static_cast<uint16_t>(level * SLOTS + slot);
+    }
+
+    template <class Func>
+    size_t process(slot_t& slot, Func& func)
+    {
+        slot_t due;
+        due.splice(due.end(), slot);
+
+        size_t expired = 0;
+        while (!due.empty())
+        {
+            auto& t = due.front();
+            due.pop_front();
+            if (t.deadline_ > now_)
+                place(t, t.deadline_);
+            else
+            {
+                ++expired;
+                func(static_cast<T&>(t));
+            }
+        }
+        return expired;
+    }
+
+    template <class Func>
+    size_t process(size_t level, size_t slot, Func& func)
+    {
+        occupied_[level] &= ~(uint64_t(1) << slot);
+        return process(slots_[level][slot], func);
+    }
+
+    /** the first step after now_ at which anything is scheduled to expire or cascade */
+    uint64_t next_event() const noexcept
+    {
+        auto next = overflow_.empty() ? std::numeric_limits<uint64_t>::max() : (now_ | rotation_mask()) + 1;
+        for (size_t level = 0; level < LEVELS; ++level)
+        {
+            auto const cur = (now_ >> level_shift(level)) & SLOT_MASK;
+            auto const ahead = occupied_[level] & ~((uint64_t(2) << cur) - 1);
+            if (!ahead)
+                continue;
+            auto const base = now_ >> level_shift(level + 1) << level_shift(level + 1);
+            auto const at = base | (uint64_t(__builtin_ctzll(ahead)) << level_shift(level));
+            next = at < next ? at : next;
+        }
+        return next;
+    }
+
+public:
+    timer_wheel(uint64_t now, unsigned resolution_shift = 0) noexcept:
+        shift_(resolution_shift), now_(now >> resolution_shift) {}
+
+    timer_wheel(timer_wheel const&) = delete;
+    timer_wheel& operator=(timer_wheel const&) = delete;
+
+    /**
+     * (Re)schedules the timer to expire at the given TSC tick, rounded up to the
+     * resolution, so never before it. Deadlines in the past expire on the next advance().
+     */
+    void arm(T& timer, uint64_t deadline) noexcept
+    {
+        timer_wheel_hook& t = timer;
+        cancel(timer);
+        auto const step = (deadline >> shift_) + !!(deadline & ((uint64_t(1) << shift_) - 1));
+        t.deadline_ = step > now_ ? step : now_ + 1;
+        place(t, t.deadline_);
+    }
+
+    void cancel(T& timer) noexcept
+    {
+        timer_wheel_hook& t = timer;
+        if (!t.is_linked())
+            return;
+        t.unlink();
+        auto const level = t.where_ / SLOTS, slot = t.where_ % SLOTS;
+        if (level < LEVELS && slots_[level][slot].empty())
+            occupied_[level] &= ~(uint64_t(1) << slot);
+    }
+
+    /**
+     * Expires all timers due at or before the given TSC tick.
+     * Callback signature: void(T&), the timer is disarmed when called and can be re-armed.
+     * @return number of expired timers
+     */
+    template <class Func>
+    size_t advance(uint64_t now, Func&& func)
+    {
+        auto const target = now >> shift_;
+        size_t expired = 0;
+        while (now_ < target)
+        {
+            auto const next = next_event();
+            if (next > target)
+            {
+                now_ = target;
+                break;
+            }
+
+            now_ = next;
+
+            if (!(now_ & rotation_mask()))
+                expired += process(overflow_, func);
+
+            // cascade from the top down every level whose block starts at this step
+            size_t top = 0;
+            while (top + 1 < LEVELS && !(now_ & ((uint64_t(1) << level_shift(top + 1)) - 1)))
+                ++top;
+            for (size_t level = top; level > 0; --level)
+                expired += process(level, (now_ >> level_shift(level)) & SLOT_MASK, func);
+
+            expired += process(0, now_ & SLOT_MASK, func);
+        }
+        return expired;
+    }
+
+    /** TSC tick of the last processed wheel step */
+    uint64_t now() const noexcept { return now_ << shift_; }
+};
+
+} // namespace ufw
@@ -0,0 +1,100 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "tsc_clock.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace ufw {
+
+/**
+ * Batch size limit for the invokev_n() calls of one stage, set after each call from
+ * the number of nodes it got and the TSC ticks it took.
+ *
+ * A batch is released downstream as a whole, so a big one holds its first node back
+ * for the time of the rest: the limit is capped by the target latency over the cost
+ * of a node (an exponential average of the observed ones). Below that it follows the
+ * backlog, a full batch means there was at least as much and doubles the limit,
+ * a partial one sets it to twice its size, an empty call drops it to min_batch.
+ * Sparse load gets small batches then, a burst gets big ones within a few calls.
+ */
+class adaptive_batch
+{
+public:
+    /**
+     * @param min_batch, max_batch bounds of the limit, max_batch at most the ring's
+     * @param target_ticks the longest batch wanted, TSC ticks
+     */
+    adaptive_batch(size_t min_batch, size_t max_batch, uint64_t target_ticks) noexcept:
+        min_(std::max<size_t>(1, min_batch)),
+        max_(std::max(min_, max_batch)),
+        target_(double(target_ticks)),
+        limit_(min_)
+    {}
+
+    adaptive_batch(size_t min_batch, size_t max_batch, std::chrono::nanoseconds target) noexcept:
+        adaptive_batch(min_batch, max_batch, tsc_ticks(target))
+    {}
+
+    /** the limit for the next call */
+    size_t limit() const noexcept { return limit_; }
+
+    /** mean cost of a node so far, TSC ticks, 0 before the first non-empty call */
+    double cost() const noexcept { return cost_; }
+
+    /** feeds back a call made with limit() */
+    void observe(size_t done, uint64_t ticks) noexcept
+    {
+        if (done)
+        {
+            auto const sample = double(ticks) / done;
+            cost_ = cost_ > 0 ? cost_ + (sample - cost_) / 8 : sample;
+        }
+
+        auto const cap = cost_ > 0 ? size_t(target_ / cost_) : max_;
+        auto const want = done >= limit_ ? 2 * limit_ : 2 * done;
+        limit_ = std::clamp(std::min(want, cap), min_, max_);
+    }
+
+    /**
+     * Times the call and observes it, an empty one is not timed.
+     * Callback signature: size_t(size_t limit), e.g. a ring's invokev_n bound to a stage
+     * @return what the callback returned
+     */
+    template <class Invoke>
+    size_t run(Invoke&& invoke)
+    {
+        auto const t0 = rdtsc();
+        auto const done = invoke(limit_);
+        observe(done, done ? rdtsc() - t0 : 0);
+        return done;
+    }
+
+private:
+    size_t const min_;
+    size_t const max_;
+    double const target_;
+
+    double cost_ = 0;
+    size_t limit_;
+}; // class adaptive_batch
+
+} // namespace ufw
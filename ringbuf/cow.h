@@ -5,9 +5,19 @@
 
 namespace ufw {
 
-template <class T>
+/**
+ * Copy-on-write holder, readers load a snapshot, writers store a new one.
+ * New values are allocated with Alloc through std::allocate_shared,
+ * e.g. a std::pmr::polymorphic_allocator<T> over one of the memory_resource.h pools.
+ * The last reader of a snapshot frees it, on whatever thread that is, so the pool must
+ * be a pool_resource: local_pool_resource and this_thread_resource() are not safe here.
+ */
+template <class T, class Alloc = std::allocator<T>>
 struct cow
 {
+    cow() = default;
+    explicit cow(Alloc const& alloc): alloc_(alloc) {}
+
     std::shared_ptr<T const> load()
     {
         return std::atomic_load_explicit(&ptr_, std::memory_order_acquire);
@@ -28,17 +38,20 @@ struct cow
     template <class... Args>
     void store(Args&&... args)
     {
-        store(std::make_shared<T>(std::forward<Args>(args)...));
+        store(std::allocate_shared<T>(alloc_, std::forward<Args>(args)...));
     }
 
     template <class... Args>
     std::shared_ptr<T const> exchange(Args&&... args)
     {
-        return exchange(std::make_shared<T>(std::forward<Args>(args)...));
+        return exchange(std::allocate_shared<T>(alloc_, std::forward<Args>(args)...));
     }
 
+    Alloc get_allocator() const noexcept { return alloc_; }
+
 private:
     std::shared_ptr<T const> ptr_;
+    Alloc alloc_;
 }; // struct cow
 
 } // namespace ufw
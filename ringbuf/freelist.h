@@ -0,0 +1,204 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#ifndef UFW_L1D_LINE_SIZE
+#   error "macro UFW_L1D_LINE_SIZE not defined"
+#endif
+
+namespace ufw {
+
+/**
+ * Lock-free fixed capacity pool of T-sized blocks.
+ *
+ * Threads allocate and free through their own cache (see cache), a pair of
+ * magazines of up to MAGAZINE blocks. Only a full magazine is pushed to the
+ * shared Treiber stack and only a whole one is popped from it, so a block
+ * freed by another thread comes back in a batch and the shared stack is hit
+ * once per MAGAZINE operations at most. The stack head is a 32-bit block index
+ * with a 32-bit tag bumped on every update, which defeats ABA.
+ *
+ * The blocks are carved lazily from one array allocated up front,
+ * allocation fails with nullptr once it is exhausted.
+ *
+ * @tparam T object type
+ * @tparam MAGAZINE blocks per magazine
+ */
+template <class T, size_t MAGAZINE = 32>
+class freelist
+{
+    static_assert(MAGAZINE > 0, "");
+
+    static constexpr uint32_t NIL = 0; // links are index + 1
+
+    struct node
+    {
+        std::aligned_storage_t<sizeof(T), alignof(T)> storage; // first, a block is its node
+        std::atomic<uint32_t> chain {NIL}; // next magazine, read concurrently by pop()
+        uint32_t next = NIL;               // next block in the magazine
+        uint32_t count = 0;                // magazine size, in the first block
+    };
+
+public:
+    /** per-thread front end, not thread safe, flushes its blocks back on destruction */
+    class cache
+    {
+        friend class freelist;
+
+    public:
+        explicit cache(freelist& owner) noexcept: owner_(owner) {}
+        ~cache() { owner_.flush(loaded_); owner_.flush(spent_); }
+
+        cache(cache const&) = delete;
+        cache& operator=(cache const&) = delete;
+
+        /** raw block, nullptr when the pool is exhausted */
+        void* allocate() noexcept
+        {
+            if (!loaded_.count)
+            {
+                if (spent_.count)
+                    std::swap(loaded_, spent_);
+                else if (!owner_.refill(loaded_))
+                    return nullptr;
+            }
+            auto& n = owner_.at(loaded_.head);
+            loaded_.head = n.next;
+            --loaded_.count;
+            return &n.storage;
+        }
+
+        /** any block of the owner, whichever thread allocated it */
+        void deallocate(void* p) noexcept
+        {
+            if (spent_.count == MAGAZINE)
+            {
+                owner_.push(spent_);
+                spent_ = {};
+            }
+            auto const link = owner_.index_of(p);
+            owner_.at(link).next = spent_.head;
+            spent_.head = link;
+            ++spent_.count;
+        }
+
+        template <class... Args>
+        T* make(Args&&... args) noexcept(std::is_nothrow_constructible<T, Args...>::value)
+        {
+            auto* p = allocate();
+            return p ? new(p) T(std::forward<Args>(args)...) : nullptr;
+        }
+
+        void destroy(T* x) noexcept
+        {
+            x->~T();
+            deallocate(x);
+        }
+
+    private:
+        struct magazine { uint32_t head = NIL; uint32_t count = 0; };
+
+        freelist& owner_;
+        magazine loaded_;
+        magazine spent_;
+    };
+
+    /** @param capacity number of blocks, rounded up to whole magazines */
+    explicit freelist(size_t capacity):
+        capacity_((capacity + MAGAZINE - 1) / MAGAZINE * MAGAZINE), nodes_(new node[capacity_]) {}
+
+    freelist(freelist const&) = delete;
+    freelist& operator=(freelist const&) = delete;
+
+    size_t capacity() const noexcept { return capacity_; }
+
+private:
+    using magazine = typename cache::magazine;
+
+    static uint64_t pack(uint32_t tag, uint32_t link) noexcept { return uint64_t(tag) << 32 | link; }
+    static uint32_t tag_of(uint64_t head) noexcept { return uint32_t(head >> 32); }
+    static uint32_t link_of(uint64_t head) noexcept { return uint32_t(head); }
+
+    node& at(uint32_t link) noexcept { return nodes_[link - 1]; }
+
+    uint32_t index_of(void* p) noexcept { return uint32_t(static_cast<node*>(p) - nodes_.get()) + 1; }
+
+    void push(magazine const& m) noexcept
+    {
+        auto& first = at(m.head);
+        first.count = m.count;
+        auto head = head_.load(std::memory_order_relaxed);
+        do first.chain.store(link_of(head), std::memory_order_relaxed);
+        while (!head_.compare_exchange_weak(head, pack(tag_of(head) + 1, m.head),
+                                            std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    bool pop(magazine& m) noexcept
+    {
+        auto head = head_.load(std::memory_order_acquire);
+        while (link_of(head))
+        {
+            auto const next = at(link_of(head)).chain.load(std::memory_order_relaxed);
+            if (head_.compare_exchange_weak(head, pack(tag_of(head) + 1, next),
+                                            std::memory_order_acquire, std::memory_order_acquire))
+            {
+                m.head = link_of(head);
+                m.count = at(m.head).count;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** a magazine from the shared stack, or fresh blocks */
+    bool refill(magazine& m) noexcept
+    {
+        if (pop(m))
+            return true;
+
+        auto const begin = carved_.fetch_add(MAGAZINE, std::memory_order_relaxed);
+        if (begin >= capacity_)
+            return false;
+        for (size_t i = 0; i < MAGAZINE; ++i)
+            nodes_[begin + i].next = i + 1 < MAGAZINE ? uint32_t(begin + i + 2) : NIL;
+        m.head = uint32_t(begin + 1);
+        m.count = MAGAZINE;
+        return true;
+    }
+
+    void flush(magazine const& m) noexcept
+    {
+        if (m.count)
+            push(m);
+    }
+
+    size_t const capacity_;
+    std::unique_ptr<node[]> nodes_;
+
+    alignas(UFW_L1D_LINE_SIZE) std::atomic<uint64_t> head_ {pack(0, NIL)};
+    alignas(UFW_L1D_LINE_SIZE) std::atomic<size_t> carved_ {0};
+};
+
+} // namespace ufw
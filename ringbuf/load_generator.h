@@ -0,0 +1,172 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "tsc_clock.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+#include <sys/prctl.h>
+
+namespace ufw {
+
+/**
+ * Open loop send schedule: the i-th message is due at start + i / rate on the TSC
+ * timeline, whenever the previous ones actually went out. The sender stamps the
+ * message with the intended time wait() returns, so the latency measured from it
+ * includes the time a late send was queued behind (no coordinated omission).
+ *
+ * Waits are hybrid: sleeps until spin_threshold before the slot, then spins.
+ * The timer slack of the calling thread is cut to 1ns, with the default 50us
+ * a short sleep_for() oversleeps by that much.
+ */
+class pacer
+{
+public:
+    /**
+     * @param rate messages per second, 0 - closed loop, wait() returns immediately
+     * @param spin_threshold the spin part of a wait
+     */
+    explicit pacer(double rate, std::chrono::nanoseconds spin_threshold = std::chrono::microseconds(100)) noexcept:
+        period_(rate > 0 ? tsc_ticks(std::chrono::duration<double>(1 / rate)) : 0),
+        spin_threshold_(tsc_ticks(spin_threshold)),
+        start_(rdtsc())
+    {
+        if (period_)
+            ::prctl(PR_SET_TIMERSLACK, 1ul, 0, 0, 0);
+    }
+
+    /** intended send time of the i-th message, TSC ticks */
+    uint64_t intended(size_t i) const noexcept { return start_ + period_ * i; }
+
+    /**
+     * Waits for the i-th slot, a slot already due returns at once.
+     * @return its intended time, the current time when unpaced, TSC ticks
+     */
+    uint64_t wait(size_t i) noexcept
+    {
+        auto now = rdtsc();
+        if (!period_)
+            return now;
+
+        auto const at = intended(i);
+        if (at > now + spin_threshold_)
+            std::this_thread::sleep_for(ns_of(at - now - spin_threshold_));
+        while ((now = rdtsc()) < at)
+            zzz();
+
+        auto const lag = now - at;
+        max_lag_ = std::max(max_lag_, lag);
+        late_ += lag > period_;
+        return at;
+    }
+
+    /** the worst send time behind the schedule */
+    std::chrono::nanoseconds max_lag() const noexcept { return ns_of(max_lag_); }
+
+    /** number of sends more than a period behind the schedule */
+    size_t late() const noexcept { return late_; }
+
+private:
+    static std::chrono::nanoseconds ns_of(uint64_t ticks) noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(tsc_cast<tsc_clock::duration>(ticks));
+    }
+
+    uint64_t const period_;
+    uint64_t const spin_threshold_;
+    uint64_t const start_;
+
+    uint64_t max_lag_ = 0;
+    size_t late_ = 0;
+};
+
+/**
+ * Log-linear latency histogram: exact below 16ns, then 16 linear buckets per power
+ * of two, so a percentile is within 1/16 of the true value. Fixed size, recording
+ * is a couple of instructions and never allocates.
+ */
+class latency_histogram
+{
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr size_t SUB = 1u << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    static size_t index_of(uint64_t ns) noexcept
+    {
+        if (ns < SUB)
+            return ns;
+        auto const e = unsigned(63 - __builtin_clzll(ns));
+        return (e - SUB_BITS + 1) * SUB + ((ns >> (e - SUB_BITS)) & (SUB - 1));
+    }
+
+    /** mid point of the bucket */
+    static uint64_t value_of(size_t index) noexcept
+    {
+        if (index < SUB)
+            return index;
+        auto const shift = unsigned(index / SUB - 1);
+        return ((SUB + index % SUB) << shift) + ((1ull << shift) >> 1);
+    }
+
+public:
+    void record(uint64_t ns) noexcept
+    {
+        ++counts_[index_of(ns)];
+        ++count_;
+        max_ = std::max(max_, ns);
+    }
+
+    void record(std::chrono::nanoseconds ns) noexcept { record(uint64_t(std::max<int64_t>(ns.count(), 0))); }
+
+    void merge(latency_histogram const& other) noexcept
+    {
+        for (size_t i = 0; i < BUCKETS; ++i)
+            counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    void reset() noexcept { *this = latency_histogram(); }
+
+    size_t count() const noexcept { return count_; }
+
+    uint64_t max() const noexcept { return max_; }
+
+    /** @param p percentile, 0 - 100 */
+    uint64_t percentile(double p) const noexcept
+    {
+        auto const rank = uint64_t(p / 100.0 * count_);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i)
+            if ((seen += counts_[i]) > rank)
+                return std::min(value_of(i), max_);
+        return max_;
+    }
+
+private:
+    std::array<uint64_t, BUCKETS> counts_ {};
+    uint64_t count_ = 0;
+    uint64_t max_ = 0;
+};
+
+} // namespace ufw
@@ -0,0 +1,292 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "tsc_clock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+
+#ifndef UFW_L1D_LINE_SIZE
+#   error "macro UFW_L1D_LINE_SIZE not defined"
+#endif
+
+namespace ufw {
+
+namespace details {
+
+struct null_lock
+{
+    void lock() noexcept {}
+    void unlock() noexcept {}
+};
+
+struct spin_lock
+{
+    void lock() noexcept
+    {
+        while (locked_.exchange(true, std::memory_order_acquire))
+            while (locked_.load(std::memory_order_relaxed))
+                zzz();
+    }
+
+    void unlock() noexcept { locked_.store(false, std::memory_order_release); }
+
+private:
+    std::atomic<bool> locked_ {false};
+};
+
+} // namespace details
+
+/**
+ * Size-class pool: requests up to MAX_BLOCK bytes are rounded up to a power of two
+ * (at least the alignment) and served from a free list of that class, refilled a
+ * CHUNK at a time from upstream. Each class has its own lock on its own cache line,
+ * bigger requests go to upstream as is. Memory returns to upstream on release() only.
+ *
+ * @tparam Lock details::spin_lock - thread safe, details::null_lock - single thread
+ */
+template <class Lock>
+class basic_pool_resource: public std::pmr::memory_resource
+{
+public:
+    static constexpr size_t MIN_BLOCK = 16;
+    static constexpr size_t MAX_BLOCK = 4096;
+    static constexpr size_t CHUNK = 64 * 1024;
+
+    explicit basic_pool_resource(std::pmr::memory_resource* upstream = std::pmr::get_default_resource()) noexcept:
+        upstream_(upstream) {}
+
+    basic_pool_resource(basic_pool_resource const&) = delete;
+    basic_pool_resource& operator=(basic_pool_resource const&) = delete;
+
+    ~basic_pool_resource() override { release(); }
+
+    /** returns all chunks to upstream, the blocks handed out become invalid */
+    void release() noexcept
+    {
+        for (size_t i = 0; i < CLASSES; ++i)
+        {
+            auto& c = classes_[i];
+            for (auto* chunk = c.chunks; chunk;)
+            {
+                auto* const next = chunk->next;
+                upstream_->deallocate(chunk, CHUNK, MIN_BLOCK << i);
+                chunk = next;
+            }
+            c.chunks = c.free = nullptr;
+        }
+    }
+
+    std::pmr::memory_resource* upstream_resource() const noexcept { return upstream_; }
+
+private:
+    static constexpr size_t CLASSES = __builtin_ctzll(MAX_BLOCK / MIN_BLOCK) + 1;
+    static constexpr size_t NONE = CLASSES;
+
+    struct block { block* next; };
+
+    struct alignas(UFW_L1D_LINE_SIZE) size_class
+    {
+        Lock lock;
+        block* free = nullptr;
+        block* chunks = nullptr; // the first block of a chunk links the chunks
+    };
+
+    static size_t class_of(size_t bytes, size_t alignment) noexcept
+    {
+        auto const size = std::max({bytes, alignment, MIN_BLOCK});
+        if (size > MAX_BLOCK)
+            return NONE;
+        return size_t(64 - __builtin_clzll((size - 1) | (MIN_BLOCK - 1))) - __builtin_ctzll(MIN_BLOCK);
+    }
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        auto const i = class_of(bytes, alignment);
+        if (i == NONE)
+            return upstream_->allocate(bytes, alignment);
+
+        auto& c = classes_[i];
+        std::lock_guard<Lock> guard(c.lock);
+        if (!c.free)
+            refill(c, MIN_BLOCK << i);
+        auto* const b = c.free;
+        c.free = b->next;
+        return b;
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        auto const i = class_of(bytes, alignment);
+        if (i == NONE)
+            return upstream_->deallocate(p, bytes, alignment);
+
+        auto& c = classes_[i];
+        auto* const b = static_cast<block*>(p);
+        std::lock_guard<Lock> guard(c.lock);
+        b->next = c.free;
+        c.free = b;
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override { return this == &other; }
+
+    /** aligned to the block size, so is every block, the writes of the links fault the pages in */
+    void refill(size_class& c, size_t size)
+    {
+        auto* const base = static_cast<char*>(upstream_->allocate(CHUNK, size));
+        auto* const chunk = reinterpret_cast<block*>(base);
+        chunk->next = c.chunks;
+        c.chunks = chunk;
+
+        for (auto* p = base + CHUNK - size; p != base; p -= size)
+        {
+            auto* const b = reinterpret_cast<block*>(p);
+            b->next = c.free;
+            c.free = b;
+        }
+    }
+
+    std::pmr::memory_resource* const upstream_;
+    size_class classes_[CLASSES];
+};
+
+/** thread safe size-class pool */
+using pool_resource = basic_pool_resource<details::spin_lock>;
+
+/** single thread size-class pool, no atomics on the hot path */
+using local_pool_resource = basic_pool_resource<details::null_lock>;
+
+/**
+ * The calling thread's own local_pool_resource, lives as long as the thread.
+ * Memory from it must be freed by the same thread, memory that may be released elsewhere
+ * (a cow snapshot, a buffer shared with another thread) takes a pool_resource.
+ */
+inline local_pool_resource& this_thread_resource() noexcept
+{
+    static thread_local local_pool_resource resource(std::pmr::new_delete_resource());
+    return resource;
+}
+
+/**
+ * Monotonic per-batch arena: allocation is a pointer bump, deallocation is a no-op,
+ * reset() takes everything back at the end of a batch.
+ *
+ * The arena buffer is pre-faulted up front. A batch that does not fit spills to
+ * extra chunks from upstream, the next reset() replaces them with one buffer big
+ * enough for the whole batch, so the steady state neither calls upstream
+ * nor page faults. Not thread safe.
+ */
+class arena_resource: public std::pmr::memory_resource
+{
+public:
+    /** @param capacity initial arena size in bytes */
+    explicit arena_resource(size_t capacity, std::pmr::memory_resource* upstream = std::pmr::get_default_resource()):
+        upstream_(upstream)
+    {
+        grow(capacity);
+        base_ = head_;
+    }
+
+    arena_resource(arena_resource const&) = delete;
+    arena_resource& operator=(arena_resource const&) = delete;
+
+    ~arena_resource() override { free_chunks(); }
+
+    /** ends the batch, everything allocated from the arena becomes invalid */
+    void reset()
+    {
+        if (head_ != base_)
+        {
+            size_t total = 0;
+            for (auto* c = head_; c; c = c->prev)
+                total += c->size - sizeof(chunk);
+            free_chunks();
+            grow(total);
+            base_ = head_;
+        }
+        top_ = reinterpret_cast<char*>(head_ + 1);
+        used_ = 0;
+    }
+
+    /** bytes allocated in the current batch */
+    size_t used() const noexcept { return used_; }
+
+    /** size of the arena buffer */
+    size_t capacity() const noexcept { return base_->size - sizeof(chunk); }
+
+private:
+    struct alignas(std::max_align_t) chunk
+    {
+        chunk* prev;
+        size_t size;
+    };
+
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        auto* p = static_cast<void*>(top_);
+        auto space = size_t(reinterpret_cast<char*>(head_) + head_->size - top_);
+        if (!std::align(alignment, bytes, p, space))
+        {
+            grow(std::max(head_->size * 2, bytes + alignment));
+            p = top_;
+            space = head_->size - sizeof(chunk);
+            std::align(alignment, bytes, p, space);
+        }
+        top_ = static_cast<char*>(p) + bytes;
+        used_ += bytes;
+        return p;
+    }
+
+    void do_deallocate(void*, size_t, size_t) noexcept override {}
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override { return this == &other; }
+
+    void grow(size_t bytes)
+    {
+        auto const size = sizeof(chunk) + std::max(bytes, size_t(4096));
+        auto* const c = static_cast<chunk*>(upstream_->allocate(size, alignof(chunk)));
+        std::memset(static_cast<void*>(c + 1), 0, size - sizeof(chunk)); // page faults now rather than on the hot path
+        *c = {head_, size};
+        head_ = c;
+        top_ = reinterpret_cast<char*>(c + 1);
+    }
+
+    void free_chunks() noexcept
+    {
+        while (head_)
+        {
+            auto* const prev = head_->prev;
+            upstream_->deallocate(head_, head_->size, alignof(chunk));
+            head_ = prev;
+        }
+    }
+
+    std::pmr::memory_resource* const upstream_;
+    chunk* head_ = nullptr; // newest chunk
+    chunk* base_ = nullptr; // the arena buffer, the oldest chunk
+    char* top_ = nullptr;
+    size_t used_ = 0;
+};
+
+} // namespace ufw
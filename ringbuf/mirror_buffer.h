@@ -0,0 +1,89 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <system_error>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace ufw {
+
+/**
+ * Byte ring mapped twice back to back, [size, 2 * size) aliases [0, size),
+ * so any range of up to size bytes starting anywhere in the ring is contiguous
+ * and a reader never has to stitch the two halves of a wrapped record.
+ * The size is rounded up to a power of 2 of at least a page.
+ */
+class mirror_buffer
+{
+public:
+    explicit mirror_buffer(size_t size): size_(round_up(size))
+    {
+        int const fd = ::memfd_create("ufw::mirror_buffer", MFD_CLOEXEC);
+        if (fd < 0)
+            throw std::system_error(errno, std::system_category(), "memfd_create");
+
+        // reserve the address range first, then map the same pages into both halves
+        void* base = MAP_FAILED;
+        if (!::ftruncate(fd, size_))
+            base = ::mmap(nullptr, 2 * size_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        bool ok = base != MAP_FAILED;
+        for (size_t half = 0; ok && half < 2; ++half)
+        {
+            auto* const at = static_cast<char*>(base) + half * size_;
+            ok = ::mmap(at, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | MAP_POPULATE, fd, 0) == at;
+        }
+
+        auto const error = errno;
+        ::close(fd);
+        if (!ok)
+        {
+            if (base != MAP_FAILED)
+                ::munmap(base, 2 * size_);
+            throw std::system_error(error, std::system_category(), "mirror_buffer");
+        }
+        base_ = static_cast<char*>(base);
+    }
+
+    ~mirror_buffer() { ::munmap(base_, 2 * size_); }
+
+    mirror_buffer(mirror_buffer const&) = delete;
+    mirror_buffer& operator=(mirror_buffer const&) = delete;
+
+    size_t size() const noexcept { return size_; }
+
+    /** first byte of the range at a free running offset, valid for size() bytes */
+    char* at(size_t offset) const noexcept { return base_ + (offset & (size_ - 1)); }
+
+private:
+    static size_t round_up(size_t size) noexcept
+    {
+        size_t x = ::sysconf(_SC_PAGESIZE);
+        while (x < size)
+            x <<= 1;
+        return x;
+    }
+
+    size_t const size_;
+    char* base_;
+};
+
+} // namespace ufw
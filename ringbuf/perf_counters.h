@@ -0,0 +1,180 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ufw {
+
+/**
+ * Per-thread group of perf_event counters, the hardware ones in user space only.
+ *
+ * Opens the hardware group (cycles, instructions, cache and branch misses) on the
+ * calling thread, falls back to the software one (task-clock, page-faults,
+ * context-switches, cpu-migrations) when the PMU is not accessible, as in most
+ * containers and VMs, and to nothing when perf_event_open is not allowed at all.
+ * The group is read atomically and scaled for multiplexing.
+ *
+ * start()/stop() enable and disable the group and accumulate, reset() zeroes it.
+ * Counts are totals since the last reset, divide by the number of messages for
+ * the per message figures.
+ */
+class perf_counters
+{
+public:
+    static constexpr size_t MAX_EVENTS = 6;
+
+    enum class mode: uint8_t { NONE, SOFTWARE, HARDWARE };
+
+    struct counter
+    {
+        char const* name;
+        double value;
+    };
+
+    struct sample
+    {
+        std::array<counter, MAX_EVENTS> counters;
+        size_t size = 0;
+
+        counter const* begin() const noexcept { return counters.data(); }
+        counter const* end() const noexcept { return counters.data() + size; }
+
+        /** 0 if not counted */
+        double operator[](char const* name) const noexcept
+        {
+            for (auto const& c: *this)
+                if (!std::strcmp(c.name, name))
+                    return c.value;
+            return 0;
+        }
+    };
+
+    /** opens the group on the calling thread, stopped */
+    perf_counters() noexcept
+    {
+        static constexpr event HARDWARE[] = {
+            {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {"l1d-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                               PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+            {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        static constexpr event SOFTWARE[] = {
+            {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+            {"page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+            {"context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+            {"cpu-migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+        };
+
+        if (open(HARDWARE))
+            mode_ = mode::HARDWARE;
+        else if (open(SOFTWARE))
+            mode_ = mode::SOFTWARE;
+    }
+
+    ~perf_counters() { close(); }
+
+    perf_counters(perf_counters const&) = delete;
+    perf_counters& operator=(perf_counters const&) = delete;
+
+    mode counting() const noexcept { return mode_; }
+
+    void reset() noexcept { control(PERF_EVENT_IOC_RESET); }
+    void start() noexcept { control(PERF_EVENT_IOC_ENABLE); }
+    void stop() noexcept { control(PERF_EVENT_IOC_DISABLE); }
+
+    /** totals since the last reset, instructions-per-cycle added in the hardware mode */
+    sample read() const noexcept
+    {
+        sample s;
+        uint64_t buf[3 + MAX_EVENTS]; // nr, time enabled, time running, values
+        if (size_ && ::read(fds_[0], buf, sizeof(buf)) > 0 && buf[0] == size_)
+        {
+            auto const scale = buf[2] ? double(buf[1]) / buf[2] : 0.0;
+            for (size_t i = 0; i < size_; ++i)
+                s.counters[s.size++] = {names_[i], buf[3 + i] * scale};
+            if (mode_ == mode::HARDWARE && s["cycles"] > 0)
+                s.counters[s.size++] = {"ipc", s["instructions"] / s["cycles"]};
+        }
+        return s;
+    }
+
+private:
+    struct event
+    {
+        char const* name;
+        uint32_t type;
+        uint64_t config;
+    };
+
+    template <size_t N>
+    bool open(event const (&events)[N]) noexcept
+    {
+        static_assert(N < MAX_EVENTS, "one slot is for ipc");
+        for (auto const& e: events)
+        {
+            perf_event_attr attr {};
+            attr.size = sizeof(attr);
+            attr.type = e.type;
+            attr.config = e.config;
+            attr.disabled = !size_; // the group follows its leader
+            attr.exclude_kernel = e.type != PERF_TYPE_SOFTWARE; // the software events happen in the kernel
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            auto const fd = int(::syscall(SYS_perf_event_open, &attr, 0 /* this thread */, -1, size_ ? fds_[0] : -1, 0));
+            if (fd < 0)
+            {
+                if (!size_)
+                    return false;
+                continue; // a member the PMU does not have
+            }
+            names_[size_] = e.name;
+            fds_[size_++] = fd;
+        }
+        return true;
+    }
+
+    void close() noexcept
+    {
+        while (size_)
+            ::close(fds_[--size_]);
+    }
+
+    void control(unsigned long request) noexcept
+    {
+        if (size_)
+            ::ioctl(fds_[0], request, PERF_IOC_FLAG_GROUP);
+    }
+
+    std::array<int, MAX_EVENTS> fds_ {};
+    std::array<char const*, MAX_EVENTS> names_ {};
+    size_t size_ = 0;
+    mode mode_ = mode::NONE;
+};
+
+} // namespace ufw
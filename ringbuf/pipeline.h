@@ -16,20 +16,15 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <limits>
+#include <tuple>
 #include <type_traits>
 
-#include <immintrin.h>
-
 namespace ufw {
 
-#if __x86_64__
-inline
-#endif
-namespace x86_64 {
-inline void zzz() noexcept { _mm_pause(); }
-}
-
 namespace details {
 
 inline constexpr size_t l1d_line_size = 64u;
@@ -50,6 +45,30 @@ template <class T, class S> struct lifecycle_tracker<T, S, false, true> {
   ~lifecycle_tracker() { reinterpret_cast<T&>(node_).~T(); }
 };
 
+/**
+ * A node changing type from From to To in place: the callback gets the From and returns
+ * the To, which replaces it. A callback returning void keeps the node as is (From == To).
+ * The From occupies the node while the callback reads it, so the To is returned into
+ * a temporary and moved into the node after the From is destroyed: one extra move of
+ * To per node, a plain copy for a trivially copyable To.
+ */
+template <class From, class To, class S> struct lifecycle_transition {
+  template <class Func, class... Args>
+  static void apply(S& node, Func& func, Args&&... args) noexcept {
+    auto& from = reinterpret_cast<From&>(node);
+    if constexpr (std::is_void_v<std::invoke_result_t<Func&, From&, Args...>>) {
+      static_assert(std::is_same_v<From, To>, "the callback must return the next stage type");
+      func(from, std::forward<Args>(args)...);
+    } else {
+      static_assert(std::is_same_v<std::invoke_result_t<Func&, From&, Args...>, To>, "the callback must return the next stage type");
+      static_assert(std::is_nothrow_move_constructible_v<To>);
+      To to = func(from, std::forward<Args>(args)...);
+      from.~From();
+      new (&node) To(std::move(to));
+    }
+  }
+};
+
 } // namespace details
 
 /**
@@ -94,10 +113,20 @@ template <class T, size_t C, size_t N = 2, size_t L = 0> struct pipeline {
    */
   template <size_t X, size_t BATCH_SIZE = CAP, class Func, class... Args>
   size_t invokev(Func&& func, Args&&... args) noexcept {
-    static_assert(X >= 0 && X < STG && BATCH_SIZE <= CAP);
+    static_assert(BATCH_SIZE <= CAP);
+    return invokev_n<X>(BATCH_SIZE, std::forward<Func>(func), std::forward<Args>(args)...);
+  }
+
+
+  /**
+   * invokev with the batch size limit set at run time, e.g. by an adaptive_batch
+   */
+  template <size_t X, class Func, class... Args>
+  size_t invokev_n(size_t limit, Func&& func, Args&&... args) noexcept {
+    static_assert(X >= 0 && X < STG);
     static_assert(std::is_nothrow_invocable_v<Func, node_t*, size_t, Args...>);
 
-    if (!BATCH_SIZE) return 0;
+    if (!limit) return 0;
 
     auto& cur_stage_pos_ = stages_[X].pos_;
     auto& prev_stage_pos_ = stages_[(X - 1) + (STG * !X)].pos_;
@@ -112,7 +141,7 @@ template <class T, size_t C, size_t N = 2, size_t L = 0> struct pipeline {
     auto prev_stage_pos = prev_stage_pos_masked & ~CAUGHT_UP_BIT;
 
     size_t const batch_size_possible = prev_stage_pos - cur_stage_pos + CAP * (prev_stage_pos <= cur_stage_pos);
-    size_t const batch_size = std::min(BATCH_SIZE, batch_size_possible);
+    size_t const batch_size = std::min(limit, batch_size_possible);
 
     if (cur_stage_pos + batch_size > CAP) {
       func(&nodes_[cur_stage_pos], CAP - cur_stage_pos, std::forward<Args>(args)...);
@@ -169,4 +198,54 @@ template <class T, size_t C, size_t N = 2, size_t L = 0> struct pipeline {
 
 };
 
+
+/**
+ A pipeline with a type per stage: stage X sees a Ts[X] in the node and leaves
+ a Ts[X+1] for the next one, in the same node, so a decode -> enrich -> serialize chain
+ needs neither a union of its types nor a ring per hop. Nodes are sized for the largest.
+ Nodes are only reachable through invoke(), the untyped invokev/invokem of a pipeline
+ would leave a Ts[X] for the next stage to read as a Ts[X+1].
+
+ * @tparam C ring buffer capacity
+ * @tparam Ts data type of each stage, the first stage is 0
+ */
+template <size_t C, class... Ts> struct typed_pipeline: private pipeline<std::aligned_union_t<0, Ts...>, C, sizeof...(Ts)> {
+ private:
+  using base = pipeline<std::aligned_union_t<0, Ts...>, C, sizeof...(Ts)>;
+
+ public:
+  template <size_t X> using stage_type = std::tuple_element_t<X, std::tuple<Ts...>>;
+
+  using typename base::node_t;
+  using base::CAP;
+  using base::STG;
+  using base::FIRST_STAGE_ID;
+  using base::LAST_STAGE_ID;
+
+  /**
+   * Callback signature: Ts[X+1] (Ts[X]&, Args...), or void (Ts[X]&, Args...) to keep
+   * the node as it is when both types are the same and always at the last stage.
+   * Constructs the first type before the first stage invocation, replaces the node with
+   * what the callback returns after every other but the last, destructs after the last.
+   * The returned value is moved into the node, a stage type costly to move had better
+   * keep its payload out of line.
+   */
+  template <size_t X, size_t n = C, class Func, class... Args>
+  size_t invoke(Func&& func, Args&&... args) noexcept {
+    using from_t = stage_type<X>;
+    static_assert(std::is_nothrow_invocable_v<Func, from_t&, Args...>);
+
+    return this->template invokem<X, n>([&func] (node_t& node, Args&&... args) noexcept {
+      details::lifecycle_tracker<from_t, node_t,
+          X == FIRST_STAGE_ID && !std::is_trivially_constructible<from_t>::value,
+          X == LAST_STAGE_ID && !std::is_trivially_destructible<from_t>::value> _(node);
+      if constexpr (X == LAST_STAGE_ID)
+        func(reinterpret_cast<from_t&>(node), std::forward<Args>(args)...);
+      else
+        details::lifecycle_transition<from_t, stage_type<X + 1>, node_t>::apply(node, func, std::forward<Args>(args)...);
+    }, std::forward<Args>(args)...);
+  }
+
+};
+
 } // namespace ufw
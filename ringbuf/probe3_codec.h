@@ -0,0 +1,270 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "probes.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) && defined(__BMI2__)
+#   include <immintrin.h>
+#   define UFW_VARINT_SIMD 1
+#else
+#   define UFW_VARINT_SIMD 0
+#endif
+
+namespace ufw {
+
+namespace details {
+
+inline uint64_t zigzag(int64_t x) noexcept { return (uint64_t(x) << 1) ^ uint64_t(x >> 63); }
+inline int64_t unzigzag(uint64_t x) noexcept { return int64_t(x >> 1) ^ -int64_t(x & 1); }
+
+inline uint8_t* put_varint(uint64_t x, uint8_t* out) noexcept
+{
+    for (; x >= 0x80; x >>= 7)
+        *out++ = uint8_t(x) | 0x80;
+    *out++ = uint8_t(x);
+    return out;
+}
+
+/** nullptr on a truncated or over-long varint */
+inline uint8_t const* get_varint(uint8_t const* in, uint8_t const* end, uint64_t& x) noexcept
+{
+    x = 0;
+    for (unsigned shift = 0; in < end && shift < 64; shift += 7)
+    {
+        auto const byte = *in++;
+        x |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return in;
+    }
+    return nullptr;
+}
+
+/**
+ * Decodes n varints, 16 bytes at a time where possible. The continuation bits
+ * of a block are gathered with one movemask: a run of single byte varints (most
+ * of the deltas) is widened 4 at a time, a longer varint is located with
+ * a count of trailing ones and its payload bits are extracted with one pext.
+ * nullptr on a malformed input. SIMD = false takes the scalar loop all the way.
+ */
+template <bool SIMD = UFW_VARINT_SIMD>
+inline uint8_t const* get_varints(uint8_t const* in, uint8_t const* end, uint64_t* out, size_t n) noexcept
+{
+    static_assert(UFW_VARINT_SIMD || !SIMD, "needs AVX2 and BMI2");
+#if UFW_VARINT_SIMD
+    while (SIMD && n && end - in >= 16 + 8 /* the last word load may run past the block */)
+    {
+        auto const block = _mm_loadu_si128(reinterpret_cast<__m128i const*>(in));
+        auto mask = unsigned(_mm_movemask_epi8(block));
+
+        // varints of up to 8 bytes, complete within the block
+        size_t used = 0;
+        while (n)
+        {
+            auto const run = std::min(size_t(__builtin_ctz(mask | (1u << (16 - used)))), n);
+            size_t i = 0;
+            for (; i + 4 <= run; i += 4, out += 4)
+            {
+                uint32_t four;
+                std::memcpy(&four, in + used + i, sizeof(four));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(int(four))));
+            }
+            for (; i < run; ++i)
+                *out++ = in[used + i];
+            n -= run;
+            used += run;
+            mask >>= run;
+            if (!n || used == 16)
+                break;
+
+            auto const len = size_t(__builtin_ctz(~mask)) + 1;
+            if (len > 8 || used + len > 16)
+                break;
+            uint64_t word;
+            std::memcpy(&word, in + used, sizeof(word));
+            word &= ~0ull >> (64 - 8 * len);
+            *out++ = _pext_u64(word, 0x7f7f7f7f7f7f7f7full);
+            --n;
+            used += len;
+            mask >>= len;
+        }
+
+        if (!used)
+        {
+            // long varint, the scalar loop takes it
+            if (!(in = get_varint(in, end, *out++)))
+                return nullptr;
+            --n;
+        }
+        in += used;
+    }
+#endif
+    for (; n; --n)
+        if (!(in = get_varint(in, end, *out++)))
+            return nullptr;
+    return in;
+}
+
+} // namespace details
+
+/**
+ * Compact wire codec of probe3 book snapshots.
+ *
+ * A snapshot is encoded against a reference, normally the previously sent one:
+ * zigzag varint deltas of seq and id, then for each side its depth, a bitmap of
+ * the levels that differ from the reference and the zigzag varint price and
+ * quantity deltas of those levels only. Without a reference (a key frame) all the
+ * levels are sent, a price as the delta to the price of the level above.
+ * Levels at or beyond depth are not sent and decode as zeroes.
+ *
+ * The decoder updates the book in place, the book being the reference on entry.
+ * A ~1KB snapshot with a couple of levels moved by a tick takes a few tens of bytes.
+ */
+struct probe3_codec
+{
+    static constexpr size_t LEVELS = sizeof(probe3::sides[0].book) / sizeof(probe3::sides[0].book[0]);
+    static_assert(LEVELS <= 32, "level bitmap is 32 bits");
+
+    /** upper bound of an encoded snapshot */
+    static constexpr size_t MAX_SIZE = 1 + 2 * 10 + 2 * (1 + 4 + LEVELS * 2 * 10);
+
+    enum : uint8_t { KEY_FRAME = 1 };
+
+    /**
+     * @param ref reference snapshot, nullptr for a key frame
+     * @param out at least MAX_SIZE bytes
+     * @return encoded size
+     */
+    static size_t encode(probe3 const& book, probe3 const* ref, uint8_t* out) noexcept
+    {
+        using namespace details;
+
+        auto* const begin = out;
+        *out++ = ref ? 0 : KEY_FRAME;
+        out = put_varint(zigzag(book.seq - (ref ? ref->seq : 0)), out);
+        out = put_varint(zigzag(book.id - (ref ? ref->id : 0)), out);
+
+        for (size_t s = 0; s < 2; ++s)
+        {
+            auto const& side = book.sides[s];
+            auto const depth = side.depth < LEVELS ? side.depth : uint8_t(LEVELS);
+            *out++ = depth;
+
+            uint32_t bitmap = 0;
+            for (size_t i = 0; i < depth; ++i)
+            {
+                bool const changed = !ref || i >= ref->sides[s].depth ||
+                                     side.book[i].px != ref->sides[s].book[i].px ||
+                                     side.book[i].qty != ref->sides[s].book[i].qty;
+                bitmap |= uint32_t(changed) << i;
+            }
+            std::memcpy(out, &bitmap, sizeof(bitmap));
+            out += sizeof(bitmap);
+
+            for (auto bits = bitmap; bits; bits &= bits - 1)
+            {
+                auto const i = size_t(__builtin_ctz(bits));
+                auto const& level = side.book[i];
+                auto const px_base = ref ? (i < ref->sides[s].depth ? ref->sides[s].book[i].px : 0)
+                                         : (i ? side.book[i - 1].px : 0);
+                auto const qty_base = ref && i < ref->sides[s].depth ? ref->sides[s].book[i].qty : 0;
+                out = put_varint(zigzag(level.px - px_base), out);
+                out = put_varint(zigzag(level.qty - qty_base), out);
+            }
+        }
+        return size_t(out - begin);
+    }
+
+    /**
+     * @param book the reference on entry (ignored for a key frame), the decoded snapshot on return
+     * @return number of bytes consumed, 0 on a malformed input, the book is then unspecified
+     * @tparam SIMD the AVX2/BMI2 varint decoder, false for the scalar one
+     */
+    template <bool SIMD = UFW_VARINT_SIMD>
+    static size_t decode(uint8_t const* in, size_t len, probe3& book) noexcept
+    {
+        using namespace details;
+
+        auto const* const begin = in;
+        auto const* const end = in + len;
+        if (in == end)
+            return 0;
+
+        bool const key = *in++ & KEY_FRAME;
+        uint64_t header[2];
+        if (!(in = get_varints<SIMD>(in, end, header, 2)))
+            return 0;
+        book.seq = (key ? 0 : book.seq) + unzigzag(header[0]);
+        book.id = (key ? 0 : book.id) + unzigzag(header[1]);
+
+        for (size_t s = 0; s < 2; ++s)
+        {
+            auto& side = book.sides[s];
+            if (end - in < 1 + 4)
+                return 0;
+            auto const ref_depth = key ? 0 : side.depth;
+            auto const depth = *in++;
+            uint32_t bitmap;
+            std::memcpy(&bitmap, in, sizeof(bitmap));
+            in += sizeof(bitmap);
+            if (depth > LEVELS || (uint64_t(bitmap) >> depth) || (key && bitmap != (depth ? ~0u >> (32 - depth) : 0u)))
+                return 0;
+
+            uint64_t deltas[2 * LEVELS];
+            auto const n = size_t(__builtin_popcount(bitmap));
+            if (!(in = get_varints<SIMD>(in, end, deltas, 2 * n)))
+                return 0;
+
+            if (key)
+            {
+                // dense, prices are a running sum
+                int64_t px = 0;
+                for (size_t i = 0; i < depth; ++i)
+                {
+                    px += unzigzag(deltas[2 * i]);
+                    side.book[i] = {px, unzigzag(deltas[2 * i + 1])};
+                }
+            }
+            else
+            {
+                // levels new to the reference start from zero
+                for (size_t i = ref_depth; i < depth; ++i)
+                    side.book[i] = {0, 0};
+
+                auto const* delta = deltas;
+                for (auto bits = bitmap; bits; bits &= bits - 1, delta += 2)
+                {
+                    auto& level = side.book[__builtin_ctz(bits)];
+                    level.px += unzigzag(delta[0]);
+                    level.qty += unzigzag(delta[1]);
+                }
+            }
+
+            for (size_t i = depth; i < LEVELS; ++i)
+                side.book[i] = {0, 0};
+            side.depth = depth;
+        }
+        return size_t(in - begin);
+    }
+};
+
+} // namespace ufw
@@ -0,0 +1,47 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Benchmark payloads: a 16B header, a 32B message, a ~1KB two-sided book snapshot
+ */
+
+struct probe1
+{
+    int64_t seq;
+    int64_t id;
+};
+
+struct probe2: probe1
+{
+    char data[sizeof(probe1)];
+};
+
+struct probe3: probe1
+{
+    struct
+    {
+        struct
+        {
+            int64_t px;
+            int64_t qty;
+        } book[32];
+        uint8_t depth;
+    } sides[2];
+};
@@ -0,0 +1,160 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "ringbuf.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#ifndef UFW_L1D_LINE_SIZE
+#   error "macro UFW_L1D_LINE_SIZE not defined"
+#endif
+
+namespace ufw {
+
+/**
+ * N single producer rings and one consumer, which only looks into the rings with news.
+ *
+ * A ring has a bit in the doorbell bitmap, RINGS_PER_LINE bits to a cache line, so that
+ * producers share a line with few others and an idle consumer loads N / RINGS_PER_LINE
+ * lines instead of N ring cursors. A producer sets its bit after a put if it is clear,
+ * which it only is once the consumer has drained the ring: the empty to non-empty
+ * transition. The consumer clears the bit of a ring it drained and checks the ring
+ * again, a fence on both sides between the write and the check, so no put goes unseen.
+ *
+ * poll() serves every ring with its bit set once, up to the ring's budget of messages,
+ * the rings in order of index (priority) or from the one after the last served
+ * (round_robin).
+ */
+template <class T, size_t CAP, size_t N, size_t RINGS_PER_LINE = 8>
+class ring_selector
+{
+    static_assert(RINGS_PER_LINE > 0 && RINGS_PER_LINE <= 64, "a 64 bit word per line");
+
+    static constexpr size_t LINES = (N + RINGS_PER_LINE - 1) / RINGS_PER_LINE;
+
+    struct alignas(UFW_L1D_LINE_SIZE) doorbell { std::atomic<uint64_t> bits {0}; };
+
+public:
+    using ring_t = ringbuf<T, CAP>;
+
+    enum class fairness { priority, round_robin };
+
+    explicit ring_selector(fairness order = fairness::round_robin, size_t budget = CAP - 1) noexcept: order_(order)
+    {
+        budgets_.fill(budget);
+    }
+
+    /** producer side, the ring of the producer, notify() after writing it directly */
+    ring_t& ring(size_t i) noexcept { return rings_[i]; }
+
+    /** producer side, rings the doorbell of the ring unless already rung */
+    void notify(size_t i) noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst); // the ring write before the doorbell check
+        auto& bits = doorbells_[i / RINGS_PER_LINE].bits;
+        auto const bit = uint64_t(1) << (i % RINGS_PER_LINE);
+        if (!(bits.load(std::memory_order_relaxed) & bit))
+            bits.fetch_or(bit, std::memory_order_release);
+    }
+
+    /**
+     * Producer side, args are forwarded to the in-place c-tor of T
+     */
+    template <class... Args>
+    bool put(size_t i, Args&&... args) noexcept
+    {
+        if (!rings_[i].put(std::forward<Args>(args)...))
+            return false;
+        notify(i);
+        return true;
+    }
+
+    /** consumer side, the most messages taken from the ring per poll() */
+    void budget(size_t i, size_t n) noexcept { budgets_[i] = std::max<size_t>(1, std::min(n, CAP - 1)); }
+
+    /**
+     * Consumer side, callback signature: void(size_t ring, T&&)
+     * @return number of messages taken
+     */
+    template <class Func>
+    size_t poll(Func&& func)
+    {
+        size_t const start = order_ == fairness::round_robin ? next_ : 0;
+        size_t const start_line = start / RINGS_PER_LINE;
+        auto const start_bits = ~uint64_t(0) << (start % RINGS_PER_LINE);
+
+        size_t taken = 0;
+        for (size_t k = 0; k <= LINES; ++k)
+        {
+            auto const line = (start_line + k) % LINES;
+            auto bits = doorbells_[line].bits.load(std::memory_order_acquire);
+            bits &= !k ? start_bits : k == LINES ? ~start_bits : ~uint64_t(0); // the start line twice, the part after it last
+            for (; bits; bits &= bits - 1)
+            {
+                auto const i = line * RINGS_PER_LINE + __builtin_ctzll(bits);
+                taken += serve(i, func);
+                next_ = i + 1 == N ? 0 : i + 1;
+            }
+        }
+        return taken;
+    }
+
+private:
+    template <class Func>
+    size_t serve(size_t i, Func& func)
+    {
+        auto const budget = budgets_[i];
+        size_t taken = 0;
+        rings_[i].template invokep<false>([&](auto* x, size_t len)
+        {
+            auto const n = std::min(len, budget - taken);
+            for (size_t j = 0; j < n; ++j)
+            {
+                T& val = reinterpret_cast<T&>(x[j]);
+                func(i, std::move(val));
+                val.~T();
+            }
+            taken += n;
+            return n;
+        });
+
+        if (taken < budget) // drained
+        {
+            auto& bits = doorbells_[i / RINGS_PER_LINE].bits;
+            auto const bit = uint64_t(1) << (i % RINGS_PER_LINE);
+            bits.fetch_and(~bit, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst); // the doorbell clear before the ring check
+            if (rings_[i].template available<false>())
+                bits.fetch_or(bit, std::memory_order_relaxed);
+        }
+        return taken;
+    }
+
+    std::array<doorbell, LINES> doorbells_;
+
+    fairness const order_;
+    size_t next_ = 0; // the ring after the last served
+    std::array<size_t, N> budgets_;
+
+    std::array<ring_t, N> rings_;
+}; // class ring_selector
+
+} // namespace ufw
@@ -15,353 +15,382 @@
 */
 
 #include "logger.h"
+#include "adaptive_batch.h"
+#include "freelist.h"
 #include "ringbuf.h"
 #include "pipeline.h"
+#include "probes.h"
+#include "probe3_codec.h"
+#include "ring_selector.h"
+#include "seqlock.h"
+#include "soa_ringbuf.h"
+#include "spsc_queue.h"
+#include "swmr_map.h"
 #include "tsc_clock.h"
 
-#include <chrono>
+#include <algorithm>
+#include <cassert>
 #include <atomic>
+#include <cstring>
+#include <memory>
+#include <string>
 #include <thread>
+#include <vector>
 
-#include <type_traits>
-
-#define likely(x) __builtin_expect(!!(x), 1)
-#define unlikely(x) __builtin_expect(!!(x), 0)
-
-#include <iomanip>
-#include <pthread.h>
-
-using myclock = ufw::tsc_clock;
-
-void pin_me(size_t cpu_id)
-{
-    cpu_set_t cpuset {};
-    CPU_SET(cpu_id, &cpuset);
-    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-}
-
-void name_me(char const* name)
-{
-    pthread_setname_np(pthread_self(), name);
-}
-
-struct probe1
-{
-    int64_t seq;
-    int64_t id;
-};
-
-struct probe2: probe1
+// g++ @flags.txt -o ringbuf ringbuf.cc
+// the throughput and latency scenarios are in ../benchmarked/ringbuf.cc
+int main()
 {
-    char data[sizeof(probe1)];
-};
+    SET_LOG_LEVEL(info);
 
-struct probe3: probe1
-{
-    struct
-    {
-        struct
-        {
-            int64_t px;
-            int64_t qty;
-        } book[32];
-        uint8_t depth;
-    } sides[2];
-};
-
-template <size_t X, class T, size_t C, size_t N, class P>
-struct stage {
-    std::atomic<bool>& must_continue;
-    P pipe;
-
-    void operator()(auto cpu_id, auto name)noexcept{
-        LOG_DBG << name << " started";
-
-//         auto min = myclock::duration::max();
-//         auto max = myclock::duration::zero();
-// 
-//         auto mean = std::chrono::duration<double, std::nano>::zero();
-//         double n = 0.0;
-//         size_t starved = 0;
-// 
-//         std::array<T, N> dst;
-//         size_t pos = 0;
-//         auto const code = [&](T& x, auto now) {
-//             if (false) // if (X)
-//                 dst[pos++] = x;
-//             else ++pos;
-//             x = now;
-//         };
-// 
-//         pin_me(cpu_id);
-//         name_me(name);
-//         auto const start = myclock::now();
-//         size_t count = 0;
-//         while (must_continue) {
-//             myclock::time_point now; // = myclock::now();
-//             pos = 0;
-// 
-//             bool starved_this_time = false;
-//             while (must_continue && !pipe->template handle<X, N>(code, now)) {
-//                 starved_this_time = true;
-//                 asm volatile("pause\n": : :"memory");
-//             }
-//             starved += starved_this_time;
-// 
-//             if (false) // if (X)
-//             for (size_t i = 0; i < pos; ++i)
-//             {
-//                 T& x = dst[i];
-//                 auto lat = now - x;
-//                 min = lat < min ? lat : min;
-//                 max = lat > max ? lat : max;
-// 
-//                 n += (n <= 1000);
-//                 mean += (lat - mean) / n;
-//             }
-// 
-//             count += pos;
-//         }
-
-        auto const code = [&](T&x) noexcept {
-            __asm__ __volatile__("" :: "m" (&x));
-        };
+    LOG_INF << "TSC ticks/ps: " << ufw::tsc_clock::scale().count() << std::endl;
 
-        pin_me(cpu_id);
-        name_me(name);
-        auto const start = myclock::now();
-        size_t count = 0;
-        for (; must_continue; count += pipe->template invoke<X, N>(code));
-
-        auto const end = myclock::now();
-        auto const duration = std::chrono::duration<double>(end - start);
-
-        LOG_INF << name << ": "
-                << count << " cycles, " << sizeof(T) << "B msg, " << C << " in ring, " << N << " in batch: "
-                << std::fixed << std::setprecision(2)
-                << count / duration.count() << "/sec, "
-                << 1e-9 * sizeof(T) * (count) / duration.count() << " GB/sec";
-//                 << "starved " << starved << " times (" << ( 100.0 * starved / count) << "%)";
-//         if (false) // if (X)
-//         LOG_INF << name << ": min: "
-//                 << std::chrono::duration<double, std::nano>(min).count() << "ns, max: "
-//                 << std::chrono::duration<double, std::nano>(max).count() << "ns, mean: " << mean.count() << "ns";
-
-        LOG_DBG << name << " stopped";
+    if (true) {
+        ufw::pipeline<int64_t, 16, 2> pipe;
+        assert((pipe.invokem<1>([](auto&) noexcept {}) == 0));
+        assert((pipe.invokem<0>([](auto&) noexcept {}) == 16));
+        assert((pipe.invokem<1, 12>([](auto&) noexcept {}) == 12));
+        assert((pipe.invokem<1>([](auto&) noexcept {}) == 4));
+        assert((pipe.invokem<1>([](auto&) noexcept {}) == 0));
+        assert((pipe.invokem<0, 7>([](auto&) noexcept {}) == 7));
+        assert((pipe.invokem<1>([](auto&) noexcept {}) == 7));
     }
-};
-
-template <class T, size_t C, size_t N = C>
-void run_pipeline()
-{
-    using namespace std::literals;
-
-    std::atomic<bool> must_continue {true};
-    auto pipe = std::make_shared<ufw::pipeline<T, C, 3>>();
-
-    std::thread writer(stage<0, T, C, N, decltype(pipe)>{must_continue, pipe}, 1, "writer");
-    std::thread observer(stage<1, T, C, N, decltype(pipe)>{must_continue, pipe}, 2, "observer");
-    std::thread reader(stage<2, T, C, N,  decltype(pipe)>{must_continue, pipe}, 3, "reader");
-
-    LOG_DBG << "main thread parked";
-    std::this_thread::sleep_for(5s);
-    LOG_DBG << "main thread resumed";
-
-    must_continue = false;
-
-    if (writer.joinable()) writer.join();
-    if (observer.joinable()) observer.join();
-    if (reader.joinable()) reader.join();
-
-    LOG_DBG << "writer, observer, reader - returned";
-}
 
-template <bool WRITER, class T, size_t C, size_t N, class R>
-struct ringv_stage {
-    std::atomic<bool>& must_continue;
-    R ring;
-
-    void operator()(auto cpu_id, auto name) noexcept{
-        LOG_DBG << name << " started";
-
-        auto const code = [&](auto* x, size_t n) noexcept {
-            for (auto end = x + n; x < end; ++x)
-                __asm__ __volatile__("" :: "m" (x));
-        };
-
-        pin_me(cpu_id);
-        name_me(name);
-        auto const start = myclock::now();
-        size_t count = 0;
-        for (; must_continue; count += ring->template invokev<WRITER, N>(code));
-
-        auto const end = myclock::now();
-        auto const duration = std::chrono::duration<double>(end - start);
-
-        LOG_INF << name << ": "
-                << count << " cycles, " << sizeof(T) << "B msg, " << C << " in ring, " << N << " in batch: "
-                << std::fixed << std::setprecision(2)
-                << count / duration.count() << "/sec, "
-                << 1e-9 * sizeof(T) * (count) / duration.count() << " GB/sec";
-
-        LOG_DBG << name << " stopped";
+    if (true) {
+        ufw::ringbuf<int64_t, 16> ring;
+        bool constexpr const WRITER = true;
+        assert((ring.invokev<!WRITER>([](auto*, size_t) noexcept {}) == 0));
+        assert((ring.invokev<WRITER>([](auto*, size_t) noexcept {}) == 15));
+        assert((ring.invokev<!WRITER, 12>([](auto*, size_t) noexcept {}) == 12));
+        assert((ring.invokev<!WRITER>([](auto*, size_t) noexcept {}) == 3));
+        assert((ring.invokev<!WRITER>([](auto*, size_t) noexcept {}) == 0));
+        assert((ring.invokev<WRITER, 7>([](auto*, size_t) noexcept {}) == 7));
+        assert((ring.invokev<!WRITER>([](auto*, size_t) noexcept {}) == 7));
     }
-};
-
-template <class T, size_t C, size_t N = C - 1>
-void run_ringv()
-{
-    using namespace std::literals;
-
-    std::atomic<bool> must_continue {true};
-    auto ring = std::make_shared<ufw::ringbuf<T, C>>();
-
-    std::thread producer(ringv_stage<true, T, C, N, decltype(ring)>{must_continue, ring}, 1, "producer");
-    std::thread consumer(ringv_stage<false, T, C, N, decltype(ring)>{must_continue, ring}, 2, "consumer");
-
-    LOG_DBG << "main thread parked";
-    std::this_thread::sleep_for(5s);
-    LOG_DBG << "main thread resumed";
 
-    must_continue = false;
-
-    if (producer.joinable()) producer.join();
-    if (consumer.joinable()) consumer.join();
-
-    LOG_DBG << "producer, consumer - returned";
-}
-
-template <class T>
-void run_ringbuf()
-{
-    using namespace std::literals;
-
-    auto ring = std::make_unique<ufw::ringbuf<T, (1<<15)>>();
+    if (true) {
+        probe3 book {};
+        book.seq = 1;
+        book.id = 42;
+        for (auto& side: book.sides) {
+            side.depth = 20;
+            for (int64_t i = 0; i < side.depth; ++i)
+                side.book[i] = {100'000 + i, 10 * i};
+        }
 
-    bool const number_of_readers = 1;
+        uint8_t buf[ufw::probe3_codec::MAX_SIZE];
+        probe3 copy {};
+        auto len = ufw::probe3_codec::encode(book, nullptr, buf);
+        assert(ufw::probe3_codec::decode(buf, len, copy) == len);
+        assert(!std::memcmp(&copy, &book, sizeof(book)));
+
+        auto const ref = book;
+        ++book.seq;
+        book.sides[0].book[3].px += 1;
+        book.sides[1].book[7].qty -= 5;
+        book.sides[1].depth = 21;
+        book.sides[1].book[20] = {100'021, 1};
+        len = ufw::probe3_codec::encode(book, &ref, buf);
+        assert(len < 32);
+        assert(ufw::probe3_codec::decode(buf, len, copy) == len);
+        assert(!std::memcmp(&copy, &book, sizeof(book)));
+        assert(ufw::probe3_codec::decode(buf, len - 1, copy) == 0);
+
+        LOG_INF << "probe3 codec: " << sizeof(probe3) << "B snapshot, " << len << "B delta";
+    }
 
-    std::atomic<bool> reader_can_start {false};
-    std::atomic<bool> must_continue {true};
+    if (true) {
+        using selector_t = ufw::ring_selector<int64_t, 16, 20>;
+        selector_t selector;
+        std::vector<size_t> served;
+        auto const record = [&](size_t ring, int64_t&&) { served.push_back(ring); };
+
+        assert(selector.poll(record) == 0);
+        assert(selector.put(17, 1) && selector.put(3, 1) && selector.put(9, 1) && selector.put(9, 2));
+        assert(selector.poll(record) == 4 && (served == std::vector<size_t> {3, 9, 9, 17}));
+        assert(selector.poll(record) == 0);
+
+        served.clear();
+        selector.budget(9, 1);
+        assert(selector.put(9, 3) && selector.put(9, 4) && selector.put(2, 1) && selector.put(19, 1));
+        assert(selector.poll(record) == 3 && (served == std::vector<size_t> {19, 2, 9})); // after 17, the last served
+        assert(selector.put(12, 1));
+        assert(selector.poll(record) == 2 && (served == std::vector<size_t> {19, 2, 9, 12, 9}));
+
+        selector_t priority(selector_t::fairness::priority);
+        served.clear();
+        assert(priority.put(5, 1) && priority.put(1, 1));
+        assert(priority.poll(record) == 2 && (served == std::vector<size_t> {1, 5}));
+
+        // a producer per ring, the consumer sees each ring in order and every message
+        auto fan_in = std::make_unique<ufw::ring_selector<int64_t, 1024, 32>>();
+        size_t const producers = 4, count = 100'000;
+        std::vector<std::thread> threads;
+        for (size_t p = 0; p < producers; ++p)
+            threads.emplace_back([&, p]
+            {
+                for (size_t i = 0; i < count; ++i)
+                    while (!fan_in->put(p * 8 + p, int64_t(i)))
+                        std::this_thread::yield();
+            });
+        std::array<int64_t, 32> expected {};
+        for (size_t taken = 0; taken < producers * count;)
+            taken += fan_in->poll([&](size_t ring, int64_t&& x) { assert(x == expected[ring]++); });
+        for (auto& t: threads)
+            t.join();
+        assert(fan_in->poll(record) == 0);
+    }
 
-    std::atomic<size_t> active_readers { number_of_readers };
+    if (true) {
+        ufw::spsc_queue<int64_t, 16, 2> queue;
+        int64_t x = -1;
+        assert(!queue.take([&](int64_t&& v) noexcept { x = v; }));
+        for (int64_t i = 0; i < 100; ++i)
+            queue.put(i);
+        assert(queue.allocated() == 7);
+        for (int64_t i = 0; i < 100; ++i)
+            assert(queue.take([&](int64_t&& v) noexcept { x = v; }) && x == i);
+        assert(!queue.take([&](int64_t&& v) noexcept { x = v; }));
+        for (int64_t i = 0; i < 40; ++i)
+            queue.put(i);
+        assert(queue.allocated() == 7); // off the spares
+        assert((queue.invokev<false>([](auto*, size_t) noexcept {}) == 12));
+        assert((queue.invokev<false, 8>([](auto*, size_t) noexcept {}) == 8));
+        assert((queue.invokev<true>([](auto*, size_t) noexcept {}) == 4)); // the rest of its chunk
+
+        auto const shared = std::make_shared<int>(42);
+        {
+            ufw::spsc_queue<std::shared_ptr<int>, 4> pointers;
+            for (int i = 0; i < 10; ++i)
+                pointers.put(shared);
+            pointers.take([](std::shared_ptr<int>&&) noexcept {});
+            assert(shared.use_count() == 10);
+        }
+        assert(shared.use_count() == 1);
 
-    auto const reader = [&]{
-        auto tid = std::this_thread::get_id();
-        LOG_INF << "reader started " << tid;
-        while (!reader_can_start);
-        T dst;
-        while (must_continue || ring->take([&](T&& val)
+        // in order across threads, the producer never waits
+        ufw::spsc_queue<int64_t, 64> elastic;
+        size_t const count = 1'000'000;
+        std::thread consumer([&]
         {
-            dst = std::move(val);
-        }));
-        --active_readers;
-        LOG_INF << "reader stopped " << tid;
-    };
-
-    std::thread threads[number_of_readers];
-    for (size_t i = 0; i < number_of_readers; ++i)
-        threads[i] = std::thread(reader);
-    LOG_INF << "done spawning readers";
-
-    std::this_thread::sleep_for(500ms);
-    size_t const number_of_iterations = 1<<26;
-    auto const start = myclock::now();
-    reader_can_start = true;
-    for (size_t i = 0; i < number_of_iterations; ++i)
-    {
-        while(ring->put(T{}));
-        (i == 1000) && (reader_can_start = true);
+            for (int64_t expected = 0; expected < int64_t(count);)
+                elastic.invokev<false>([&](auto* x, size_t len) noexcept
+                {
+                    for (size_t i = 0; i < len; ++i)
+                        assert(reinterpret_cast<int64_t&>(x[i]) == expected++);
+                });
+        });
+        for (size_t i = 0; i < count; ++i)
+            elastic.put(int64_t(i));
+        consumer.join();
     }
-    must_continue = false;
-    while (active_readers);
-    auto const end = myclock::now();
-    auto const duration = std::chrono::duration<double>(end - start);
-    LOG_INF << number_of_iterations << " iterations with " << sizeof(T) << " bytes payload: "<< std::fixed << std::setprecision(2)
-            << number_of_iterations / duration.count() << "/sec, "
-            << 1e-9 * sizeof(T) * (number_of_iterations) / duration.count() << " Gb/sec";
-
-    for (size_t i = 0; i < number_of_readers; ++i) threads[i].join();
-}
-
-template <size_t C>
-void ping_pong()
-{
-    auto fwd = std::make_shared<ufw::ringbuf<myclock::time_point, C>>();
-    auto bck = std::make_shared<ufw::ringbuf<myclock::time_point, C>>();
 
-    std::atomic<bool> must_continue {true};
-
-    auto code = [&must_continue](auto cpu_id, auto name, auto fwd, auto bck)
-    {
-        myclock::duration duration {};
-        size_t count {};
-
-        pin_me(cpu_id);
-        name_me(name);
-
-        // submit a seed message
-        while (!fwd->template invokev<true, 1>([&](auto* x, auto)
+    if (true) {
+        ufw::seqlock<probe1, 4> box(probe1 {0, 0});
+        probe1 x;
+        assert(box.load(x) == 0 && box.version() == 0);
+        box.store(probe1 {1, -1});
+        box.store(probe1 {2, -2});
+        assert(box.load(x) == 2 && x.seq == 2 && x.id == -2);
+
+        // a consistent and never older snapshot under a writer spinning on the other thread
+        std::atomic<bool> stop {false};
+        std::thread writer([&]
         {
-            reinterpret_cast<myclock::time_point&>(*x) = myclock::now();
-        })) ufw::zzz();
-
-        // ping-pong messages while can
-        while (must_continue)
+            for (int64_t i = 3; !stop; ++i)
+                box.store(probe1 {i, -i});
+        });
+        uint64_t seen = 0;
+        for (size_t i = 0; i < 1'000'000; ++i)
         {
-            while (!bck->template invokev<false, 1>([&](auto* x, auto)
-            {
-                duration += myclock::now() - reinterpret_cast<myclock::time_point&>(*x);
-                ++count;
-            })) ufw::zzz();
+            auto const version = box.load(x);
+            assert(x.seq == -x.id && uint64_t(x.seq) == version && version >= seen);
+            seen = version;
+        }
+        stop = true;
+        writer.join();
+    }
 
-            while (!fwd->template invokev<true, 1>([&](auto* x, auto)
+    if (true) {
+        ufw::swmr_map<uint64_t, probe1> map;
+        probe1 x;
+        for (uint64_t i = 0; i < 100'000; ++i)
+            assert(map.insert_or_assign(i, probe1 {int64_t(i), -int64_t(i)}));
+        assert(!map.insert_or_assign(7, probe1 {7, 7}) && map.find(7, x) && x.id == 7);
+        for (uint64_t i = 0; i < 100'000; i += 2)
+            assert(map.erase(i));
+        assert(!map.erase(0) && map.size() == 50'000);
+        for (uint64_t i = 0; i < 100'000; ++i)
+            assert(map.find(i, x) == (i % 2 == 1) && (!(i % 2) || x.seq == int64_t(i)));
+
+        // churn through tombstone purges and growth, readers on the other thread
+        // must see every key the writer has published and never a torn value
+        std::atomic<uint64_t> published {0};
+        std::atomic<bool> stop {false};
+        std::thread reader([&]
+        {
+            probe1 y;
+            for (uint64_t n = 0; !stop; n = (n + 7919) % 1'000'000)
             {
-                reinterpret_cast<myclock::time_point&>(*x) = myclock::now();
-            })) ufw::zzz();
+                auto const upto = published.load(std::memory_order_acquire);
+                auto const key = 200'000 + (upto ? n % upto : 0);
+                auto const found = map.find(key, y);
+                assert(!upto || (found && y.seq == -y.id && y.seq >= int64_t(key)));
+            }
+        });
+        size_t retired = 0;
+        for (uint64_t i = 0; i < 300'000; ++i)
+        {
+            map.insert_or_assign(200'000 + i, probe1 {int64_t(200'000 + i), -int64_t(200'000 + i)});
+            map.insert_or_assign(200'000 + i / 2, probe1 {int64_t(200'000 + i), -int64_t(200'000 + i)});
+            published.store(i + 1, std::memory_order_release);
+            if (i < 100'000)
+                map.erase(i);
+            retired = std::max(retired, map.retired());
         }
+        stop = true;
+        reader.join();
+        // the writer frees the old tables itself, once the reader is out of them
+        assert(retired <= 2);
+        map.reclaim();
+        map.reclaim();
+        assert(map.size() == 300'000 && !map.retired());
+    }
 
-        LOG_INF << name << ": " << C << " msg-s in the ring, " << (std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / double(count)) << " ns/msg";
-    };
-
-    std::thread ping(code, 1, "ping", fwd, bck);
-    std::thread pong(code, 2, "pong", bck, fwd);
-
-    std::this_thread::sleep_for(std::chrono::seconds(5));
-
-    must_continue = false;
-
-    if (ping.joinable()) ping.join();
-    if (pong.joinable()) pong.join();
-}
+    if (true) {
+        ufw::pipeline<int64_t, 16, 2> pipe;
+        assert((pipe.invokev_n<0>(0, [](auto*, size_t) noexcept {}) == 0));
+        assert((pipe.invokev_n<0>(9, [](auto*, size_t) noexcept {}) == 9));
+        assert((pipe.invokev_n<1>(100, [](auto*, size_t) noexcept {}) == 9));
 
-// g++ @flags.txt -o ringbuf ringbuf.cc
-int main()
-{
-    SET_LOG_LEVEL(info);
+        ufw::ringbuf<int64_t, 16> ring;
+        assert((ring.invokev_n<true>(100, [](auto*, size_t) noexcept {}) == 15));
+        assert((ring.invokev_n<false>(4, [](auto*, size_t) noexcept {}) == 4));
+
+        // cost 10 ticks a node, 1000 ticks target: doubles while full up to 100
+        ufw::adaptive_batch batch(4, 256, uint64_t(1000));
+        assert(batch.limit() == 4);
+        for (size_t expected: {8, 16, 32, 64, 100, 100}) {
+            batch.observe(batch.limit(), 10 * batch.limit());
+            assert(batch.limit() == expected);
+        }
+        batch.observe(10, 100);
+        assert(batch.limit() == 20);
+        batch.observe(0, 0);
+        assert(batch.limit() == 4);
+        batch.observe(4, 4000); // cost 10 + (1000 - 10) / 8, caps at 7
+        assert(batch.limit() == 7);
+
+        assert((ring.invokev_n<false>(100, [](auto*, size_t) noexcept {}) == 11));
+        for (size_t i = 0; i < 11; ++i)
+            ring.put(int64_t(i));
+        int64_t sum = 0;
+        auto const take = [&](size_t limit) {
+            return ring.invokev_n<false>(limit, [&](auto* x, size_t len) noexcept {
+                for (size_t j = 0; j < len; ++j)
+                    sum += reinterpret_cast<int64_t&>(x[j]);
+            });
+        };
+        assert(batch.run(take) == 7 && batch.run(take) == 4 && sum == 55);
+    }
 
-    LOG_INF << "TSC ticks/ps: " << ufw::tsc_clock::scale().count() << std::endl;
+    if (true) {
+        // the producer writes an int64_t, the next stage makes it a std::string,
+        // the third edits that in place and the last drops it
+        ufw::typed_pipeline<8, int64_t, int64_t, std::string, std::string> pipe;
+        static_assert(sizeof(decltype(pipe)::node_t) == sizeof(std::string));
+        int64_t produced = 0, consumed = 0;
+        size_t edited = 0;
+        for (size_t round = 0; round < 5; ++round) {
+            pipe.invoke<0, 5>([&](int64_t& x) noexcept { x = produced++; });
+            pipe.invoke<1>([](int64_t& x) noexcept { return std::to_string(x) + " bytes to stay out of the SSO buffer"; });
+            edited += pipe.invoke<2, 3>([](std::string& x) noexcept { x += '!'; });
+            pipe.invoke<3>([&](std::string& x) noexcept {
+                assert(x == std::to_string(consumed++) + " bytes to stay out of the SSO buffer!");
+            });
+        }
+        assert(produced == 20 && edited == 15 && consumed == 15); // 8 nodes, 5 in flight
+        assert((pipe.invoke<2>([](std::string& x) noexcept { x += '!'; }) == 5));
+        pipe.invoke<3>([&](std::string& x) noexcept { assert(x.find(std::to_string(consumed++)) == 0); });
+        assert(consumed == 20);
+
+        auto const p = std::make_shared<int>(42);
+        ufw::typed_pipeline<4, std::shared_ptr<int>, std::shared_ptr<int>, int64_t> ptrs;
+        assert((ptrs.invoke<0>([&](std::shared_ptr<int>& x) noexcept { x = p; }) == 4 && p.use_count() == 5));
+        assert((ptrs.invoke<1, 2>([](std::shared_ptr<int>& x) noexcept { return int64_t(*x); }) == 2 && p.use_count() == 3));
+        assert((ptrs.invoke<2>([](int64_t& x) noexcept { assert(x == 42); }) == 2));
+        assert((ptrs.invoke<1>([](std::shared_ptr<int>& x) noexcept { return int64_t(*x); }) == 2 && p.use_count() == 1));
+    }
 
     if (true) {
-        ufw::pipeline<int64_t, 16, 2> pipe;
-        assert((pipe.invokem<1>([](auto&){}) == 0));
-        assert((pipe.invokem<0>([](auto&){}) == 16));
-        assert((pipe.invokem<1, 12>([](auto&){}) == 12));
-        assert((pipe.invokem<1>([](auto&){}) == 4));
-        assert((pipe.invokem<1>([](auto&){}) == 0));
-        assert((pipe.invokem<0, 7>([](auto&){}) == 7));
-        assert((pipe.invokem<1>([](auto&){}) == 7));
+        ufw::soa_ringbuf<probe3, 16, &probe3::seq, &probe3::id, &probe3::sides> ring;
+        probe3 book {};
+        book.sides[1].book[31].px = 100;
+        for (int64_t i = 0; i < 15; ++i) {
+            book.seq = i;
+            book.id = -i;
+            assert(ring.put(book));
+        }
+        assert(!ring.put(book));
+
+        // the columns of a batch, seq and id only, wrapping around after the first take
+        assert(ring.take([](probe3&& x) noexcept { assert(x.seq == 0 && x.id == 0 && x.sides[1].book[31].px == 100); }));
+        assert(ring.take([](probe3&& x) noexcept { assert(x.seq == 1 && x.id == -1); }));
+        assert(ring.put(book) && ring.put(book));
+        int64_t sum = 0;
+        size_t calls = 0;
+        assert((ring.invokev<false>([&](size_t len, int64_t* seq, int64_t* id, auto*) noexcept {
+            for (size_t i = 0; i < len; ++i)
+                sum += seq[i] - id[i];
+            ++calls;
+        }) == 15));
+        assert(calls == 2 && sum == 2 * (14 * 15 / 2 - 1 + 14 + 14));
+        assert(!ring.take([](probe3&&) noexcept { assert(false); }));
     }
 
     if (true) {
-        ufw::ringbuf<int64_t, 16> ring;
-        bool constexpr const WRITER = true;
-        assert((ring.invokev<!WRITER>([](auto*, size_t){}) == 0));
-        assert((ring.invokev<WRITER>([](auto*, size_t){}) == 15));
-        assert((ring.invokev<!WRITER, 12>([](auto*, size_t){}) == 12));
-        assert((ring.invokev<!WRITER>([](auto*, size_t){}) == 3));
-        assert((ring.invokev<!WRITER>([](auto*, size_t){}) == 0));
-        assert((ring.invokev<WRITER, 7>([](auto*, size_t){}) == 7));
-        assert((ring.invokev<!WRITER>([](auto*, size_t){}) == 7));
+        // a producer allocates, a consumer frees: the blocks go back through the shared stack
+        // a magazine at a time, a block handed out again while in flight would be restamped
+        ufw::freelist<probe1, 8> pool(256);
+        ufw::ringbuf<probe1*, 64> ring;
+        int64_t const total = 200'000;
+
+        std::thread consumer([&]
+        {
+            ufw::freelist<probe1, 8>::cache cache(pool);
+            for (int64_t expected = 0; expected < total;)
+            {
+                if (!ring.take([&](probe1* x) noexcept {
+                    assert(x->seq == expected && x->id == -expected);
+                    ++expected;
+                    cache.destroy(x);
+                }))
+                    std::this_thread::yield();
+            }
+        });
+
+        {
+            ufw::freelist<probe1, 8>::cache cache(pool);
+            for (int64_t i = 0; i < total; ++i)
+            {
+                // fewer than 80 blocks are ever out of the shared stack, the ring, two part magazines
+                auto* const x = cache.make(probe1 {i, -i});
+                assert(x);
+                while (!ring.put(x))
+                    std::this_thread::yield();
+            }
+        }
+        consumer.join();
+
+        // every block back, once
+        ufw::freelist<probe1, 8>::cache cache(pool);
+        std::vector<void*> blocks;
+        while (auto* p = cache.allocate())
+            blocks.push_back(p);
+        std::sort(blocks.begin(), blocks.end());
+        assert(blocks.size() == pool.capacity() && std::unique(blocks.begin(), blocks.end()) == blocks.end());
+        for (auto* p: blocks)
+            cache.deallocate(p);
     }
 
     if (false) {
@@ -371,7 +400,7 @@ int main()
         std::thread del([&]
         {
             LOG_INF << "del started";
-            for (size_t i = 0; i < iterations; i += pipe.invokem<2>([](auto& node)
+            for (size_t i = 0; i < iterations; i += pipe.invokem<2>([](auto& node) noexcept
             {
                 int64_t& x = reinterpret_cast<int64_t&>(node);
                 LOG_INF << "del: " << x << "->" << x*7;
@@ -383,7 +412,7 @@ int main()
         std::thread upd([&]
         {
             LOG_INF << "upd started";
-            for (size_t i = 0; i < iterations; i += pipe.invokem<1>([](auto& node)
+            for (size_t i = 0; i < iterations; i += pipe.invokem<1>([](auto& node) noexcept
             {
                 int64_t& x = reinterpret_cast<int64_t&>(node);
                 if (x%3) { LOG_ERR << "unexpected value:" << x; abort();}
@@ -396,7 +425,7 @@ int main()
         {
             LOG_INF << "ins started";
             size_t counter = 0;
-            for (size_t i = 0; i < iterations; i += pipe.invokem<0>([&counter](auto& node)
+            for (size_t i = 0; i < iterations; i += pipe.invokem<0>([&counter](auto& node) noexcept
             {
                 int64_t& x = reinterpret_cast<int64_t&>(node);
                 auto const val = (counter += 3);
@@ -410,36 +439,5 @@ int main()
         del.join();
     }
 
-    if (true) {
-        ping_pong<1 << 6>();
-        ping_pong<1 << 15>();
-        ping_pong<1 << 20>();
-    }
-
-    if (true) {
-        run_pipeline<probe1, 1 << 6>();
-        run_pipeline<probe1, 1 << 15>();
-        run_pipeline<probe1, 1 << 20>();
-    }
-
-    if (true) {
-        run_ringv<probe1, 1 << 5>();
-        run_ringv<probe1, 1 << 10>();
-        run_ringv<probe1, 1 << 14>();
-        run_ringv<probe2, 1 << 5>();
-        run_ringv<probe2, 1 << 10>();
-        run_ringv<probe2, 1 << 14>();
-        run_ringv<probe3, 1 << 5>();
-        run_ringv<probe3, 1 << 10>();
-        run_ringv<probe3, 1 << 14>();
-    }
-
-    if (true) { 
-        run_ringbuf<uint64_t>();
-        run_ringbuf<probe1>();
-        run_ringbuf<probe2>();
-        run_ringbuf<probe3>();
-    }
-
     return 0;
 }
@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <type_traits>
 
@@ -67,7 +69,15 @@ public:
     template <bool WRITER, size_t BATCH_SIZE = CAP - 1, class Func, class... Args>
     size_t invokev(Func&& func, Args&&... args) noexcept {
         static_assert(BATCH_SIZE <= CAP - 1, "");
+        return invokev_n<WRITER>(BATCH_SIZE, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+
 
+    /**
+     * invokev with the batch size limit set at run time, e.g. by an adaptive_batch
+     */
+    template <bool WRITER, class Func, class... Args>
+    size_t invokev_n(size_t limit, Func&& func, Args&&... args) noexcept {
         auto& self_pos_ = stages_[WRITER].pos_;
         auto& party_pos_ = stages_[!WRITER].pos_;
 
@@ -78,7 +88,7 @@ public:
         auto cmp_pos = WRITER ? next_self_pos : self_pos;
 
         size_t const batch_size_possible = party_pos - cmp_pos + CAP * (party_pos < cmp_pos);
-        size_t const batch_size = std::min(BATCH_SIZE, batch_size_possible);
+        size_t const batch_size = std::min(limit, batch_size_possible);
 
         if (self_pos + batch_size > CAP) {
             func(&nodes_[self_pos], CAP - self_pos, std::forward<Args>(args)...);
@@ -92,6 +102,56 @@ public:
     }
 
 
+    /**
+     * Callback signature: size_t(node_t*, size_t len, Args...)
+     * Returns the number of nodes processed from the front of the span,
+     * the rest stay in the ring. "P" is for "partial"
+     */
+    template <bool WRITER, size_t BATCH_SIZE = CAP - 1, class Func, class... Args>
+    size_t invokep(Func&& func, Args&&... args) noexcept {
+        static_assert(BATCH_SIZE <= CAP - 1, "");
+
+        auto& self_pos_ = stages_[WRITER].pos_;
+        auto& party_pos_ = stages_[!WRITER].pos_;
+
+        auto const self_pos = self_pos_.load(std::memory_order_relaxed /* single producer */);
+        auto const party_pos = party_pos_.load(std::memory_order_acquire);
+
+        auto const next_self_pos = next(self_pos);
+        auto cmp_pos = WRITER ? next_self_pos : self_pos;
+
+        size_t const batch_size_possible = party_pos - cmp_pos + CAP * (party_pos < cmp_pos);
+        size_t const batch_size = std::min(BATCH_SIZE, batch_size_possible);
+
+        if (!batch_size) return 0;
+
+        size_t done;
+        if (self_pos + batch_size > CAP) {
+            done = func(&nodes_[self_pos], CAP - self_pos, std::forward<Args>(args)...);
+            if (done == CAP - self_pos)
+                done += func(&nodes_[0], batch_size - (CAP - self_pos), std::forward<Args>(args)...);
+        } else {
+            done = func(&nodes_[self_pos], batch_size, std::forward<Args>(args)...);
+        }
+
+        self_pos_.store(mod_cap(self_pos + done), std::memory_order_release);
+        return done;
+    }
+
+
+    /**
+     * Number of nodes the side could invoke on now
+     */
+    template <bool WRITER>
+    size_t available() const noexcept {
+        auto const self_pos = stages_[WRITER].pos_.load(std::memory_order_relaxed /* single producer */);
+        auto const party_pos = stages_[!WRITER].pos_.load(std::memory_order_acquire);
+
+        auto const cmp_pos = WRITER ? next(self_pos) : self_pos;
+        return party_pos - cmp_pos + CAP * (party_pos < cmp_pos);
+    }
+
+
     /**
      * Args are forwarded to the in-place c-tor of T
      */
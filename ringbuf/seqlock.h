@@ -0,0 +1,145 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "tsc_clock.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#ifndef UFW_L1D_LINE_SIZE
+#   error "macro UFW_L1D_LINE_SIZE not defined"
+#endif
+
+namespace ufw {
+
+/**
+ * Latest value mailbox for trivially copyable T, single writer, any number of readers.
+ * The writer never waits, a reader copies the value out and retries if the writer
+ * was at the same slot meanwhile. No allocation and no shared writes on the read side,
+ * unlike cow, and only the newest value is there, unlike a ringbuf.
+ *
+ * Store n goes to slot n % SLOTS, with more than one slot a reader is only retried
+ * when the writer laps all of them during its read, so a fast writer does not starve
+ * slow readers of a big T. A slot sequence is 2n - 1 while store n is being written,
+ * 2n once done. The value is kept in relaxed atomic words, a torn read is detected
+ * and never a data race.
+ */
+template <class T, size_t SLOTS = 1>
+class seqlock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "copied in and out word by word");
+    static_assert(SLOTS > 0, "");
+
+    static constexpr size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    using words_t = std::array<uint64_t, WORDS>;
+
+    struct alignas(UFW_L1D_LINE_SIZE) slot
+    {
+        std::atomic<uint64_t> seq {0};
+        std::array<std::atomic<uint64_t>, WORDS> words;
+    };
+
+public:
+    explicit seqlock(T const& init = T{}) noexcept
+    {
+        for (auto& s: slots_)
+            write(s, init);
+    }
+
+    seqlock(seqlock const&) = delete;
+    seqlock& operator=(seqlock const&) = delete;
+
+    /** writer side, wait free */
+    void store(T const& val) noexcept
+    {
+        auto const n = version_.load(std::memory_order_relaxed /* single writer */) + 1;
+        auto& s = slots_[n % SLOTS];
+
+        s.seq.store(2 * n - 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        write(s, val);
+        s.seq.store(2 * n, std::memory_order_release);
+
+        version_.store(n, std::memory_order_release);
+    }
+
+    /**
+     * Copies the latest value out, retries on a torn read.
+     * @return its version, the number of stores before it and it
+     */
+    uint64_t load(T& out) const noexcept
+    {
+        uint64_t version;
+        while (!try_load(out, version))
+            zzz();
+        return version;
+    }
+
+    T load() const noexcept
+    {
+        T out;
+        load(out);
+        return out;
+    }
+
+    /**
+     * A single attempt, false if the copy was torn (out is garbage then) or the slot
+     * was lapped since, its newer store may not be in version() yet and the next load
+     * could go back to that.
+     */
+    bool try_load(T& out, uint64_t& version) const noexcept
+    {
+        auto const n = version_.load(std::memory_order_acquire);
+        auto const& s = slots_[n % SLOTS];
+
+        auto const seq = s.seq.load(std::memory_order_acquire);
+        if (seq != 2 * n)
+            return false;
+
+        words_t buf;
+        for (size_t i = 0; i < WORDS; ++i)
+            buf[i] = s.words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed) != seq)
+            return false;
+
+        std::memcpy(&out, buf.data(), sizeof(T));
+        version = n;
+        return true;
+    }
+
+    /** number of stores so far, a cheap check for news */
+    uint64_t version() const noexcept { return version_.load(std::memory_order_acquire); }
+
+private:
+    static void write(slot& s, T const& val) noexcept
+    {
+        words_t buf {};
+        std::memcpy(buf.data(), &val, sizeof(T));
+        for (size_t i = 0; i < WORDS; ++i)
+            s.words[i].store(buf[i], std::memory_order_relaxed);
+    }
+
+    alignas(UFW_L1D_LINE_SIZE) std::atomic<uint64_t> version_ {0};
+    std::array<slot, SLOTS> slots_;
+}; // class seqlock
+
+} // namespace ufw
@@ -0,0 +1,140 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#ifndef UFW_L1D_LINE_SIZE
+#   error "macro UFW_L1D_LINE_SIZE not defined"
+#endif
+
+namespace ufw {
+
+namespace details {
+
+template <class P> struct member_of;
+template <class C, class M> struct member_of<M C::*> { using type = M; };
+
+} // namespace details
+
+/**
+ * The ringbuf of T laid out as a structure of arrays: each of the described Fields
+ * (pointers to members of T) lives in a column of its own, and a batch callback gets
+ * a pointer into every column instead of a span of whole records. A consumer reading
+ * only some fields touches only their columns, e.g. the seq and id of a ~1KB book
+ * snapshot are 16 bytes a message instead of a line, and a loop over a column is
+ * a loop over a plain array the compiler can vectorize.
+ *
+ * soa_ringbuf<probe3, CAP, &probe3::seq, &probe3::id, &probe3::sides>
+ *
+ * The fields are copied in and out as bytes, T is trivially copyable, the fields
+ * not described are not kept.
+ */
+template <class T, size_t CAP, auto... Fields>
+class soa_ringbuf
+{
+    static_assert(sizeof...(Fields) > 0, "");
+    static_assert(std::is_trivially_copyable<T>::value, "fields are copied in and out as bytes");
+
+    template <auto Field> using field_t = typename details::member_of<decltype(Field)>::type;
+
+    template <auto Field> struct alignas(UFW_L1D_LINE_SIZE) column { field_t<Field> values[CAP]; };
+
+    struct stage { alignas(UFW_L1D_LINE_SIZE) std::atomic<size_t> pos_ {0}; };
+    std::array<stage, 2> stages_;
+
+    std::tuple<column<Fields>...> columns_;
+
+    size_t static mod_cap(size_t x) noexcept { return x - CAP * (x >= CAP); }
+
+    template <class Func, size_t... I, class... Args>
+    void call(Func& func, size_t pos, size_t len, std::index_sequence<I...>, Args&&... args) noexcept
+    {
+        func(len, &std::get<I>(columns_).values[pos]..., std::forward<Args>(args)...);
+    }
+
+public:
+    /**
+     * Callback signature: void(size_t len, field_t<Fields>*..., Args...), a pointer
+     * to the first of len values in each column, in the order of Fields
+     */
+    template <bool WRITER, size_t BATCH_SIZE = CAP - 1, class Func, class... Args>
+    size_t invokev(Func&& func, Args&&... args) noexcept {
+        static_assert(BATCH_SIZE <= CAP - 1, "");
+        return invokev_n<WRITER>(BATCH_SIZE, std::forward<Func>(func), std::forward<Args>(args)...);
+    }
+
+    /**
+     * invokev with the batch size limit set at run time
+     */
+    template <bool WRITER, class Func, class... Args>
+    size_t invokev_n(size_t limit, Func&& func, Args&&... args) noexcept {
+        auto& self_pos_ = stages_[WRITER].pos_;
+        auto& party_pos_ = stages_[!WRITER].pos_;
+
+        auto const self_pos = self_pos_.load(std::memory_order_relaxed /* single producer */);
+        auto const party_pos = party_pos_.load(std::memory_order_acquire);
+
+        auto const cmp_pos = WRITER ? mod_cap(self_pos + 1) : self_pos;
+
+        size_t const batch_size_possible = party_pos - cmp_pos + CAP * (party_pos < cmp_pos);
+        size_t const batch_size = std::min(limit, batch_size_possible);
+
+        auto const fields = std::make_index_sequence<sizeof...(Fields)>();
+        if (self_pos + batch_size > CAP) {
+            call(func, self_pos, CAP - self_pos, fields, std::forward<Args>(args)...);
+            call(func, 0, batch_size - (CAP - self_pos), fields, std::forward<Args>(args)...);
+        } else {
+            call(func, self_pos, batch_size, fields, std::forward<Args>(args)...);
+        }
+
+        self_pos_.store(mod_cap(self_pos + batch_size), std::memory_order_release);
+        return batch_size;
+    }
+
+    /**
+     * Producer side, scatters the described fields of val into the columns
+     */
+    bool put(T const& val) noexcept {
+        return invokev<true, 1>([&val](size_t len, auto*... values) noexcept {
+            if (!len) return;
+            (std::memcpy(values, &(val.*Fields), sizeof(*values)), ...);
+        });
+    }
+
+    /**
+     * Consumer side, gathers a value initialized T with the described fields set
+     * Callback signature: void (T&&)
+     */
+    template <class F>
+    bool take(F const& func) noexcept {
+        return invokev<false, 1>([&func](size_t len, auto*... values) noexcept {
+            if (!len) return;
+            T val {};
+            (std::memcpy(&(val.*Fields), values, sizeof(*values)), ...);
+            func(std::move(val));
+        });
+    }
+}; // class soa_ringbuf
+
+} // namespace ufw
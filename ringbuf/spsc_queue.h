@@ -0,0 +1,179 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "ringbuf.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <type_traits>
+
+#ifndef UFW_L1D_LINE_SIZE
+#   error "macro UFW_L1D_LINE_SIZE not defined"
+#endif
+
+namespace ufw {
+
+/**
+ * Unbounded single producer single consumer queue, a linked list of chunks of CAP nodes.
+ * The writer never fails: when its chunk is full it links a new one, recycled
+ * from the SPARE chunks the reader hands back over a ringbuf or allocated if there
+ * are none. The reader frees a drained chunk if the spare ring is full.
+ *
+ * Within a chunk it is a ringbuf without the wrap around: the writer publishes
+ * the count of written nodes, the reader keeps its position to itself, so a put
+ * does not even load the reader's position.
+ */
+template <class T, size_t CAP, size_t SPARE = 4>
+class spsc_queue
+{
+    using node_t = std::aligned_storage_t<sizeof(T), alignof(T)>;
+
+    struct chunk
+    {
+        alignas(UFW_L1D_LINE_SIZE) std::atomic<size_t> written {0};
+        std::atomic<chunk*> next {nullptr};
+        alignas(UFW_L1D_LINE_SIZE) std::array<node_t, CAP> nodes;
+    };
+
+public:
+    spsc_queue(): writer_ {new chunk, 0}, reader_ {writer_.tail, 0, 0} { allocated_ = 1; }
+
+    spsc_queue(spsc_queue const&) = delete;
+    spsc_queue& operator=(spsc_queue const&) = delete;
+
+    ~spsc_queue()
+    {
+        for (auto* c = reader_.head; c;)
+        {
+            auto const end = c->written.load(std::memory_order_relaxed);
+            for (auto pos = c == reader_.head ? reader_.pos : 0; pos < end; ++pos)
+                reinterpret_cast<T&>(c->nodes[pos]).~T();
+            auto* const next = c->next.load(std::memory_order_relaxed);
+            delete c;
+            c = next;
+        }
+        while (spare_.take([](chunk*&& c) noexcept { delete c; }));
+    }
+
+    /**
+     * Callback signature: void(node_t*, size_t len, Args...)
+     * Both sides get a contiguous span of one chunk, the writer's is never empty.
+     */
+    template <bool WRITER, size_t BATCH_SIZE = CAP, class Func, class... Args>
+    size_t invokev(Func&& func, Args&&... args)
+    {
+        static_assert(BATCH_SIZE <= CAP, "");
+
+        if (WRITER)
+        {
+            if (writer_.pos == CAP)
+                link();
+            auto const batch_size = std::min(BATCH_SIZE, CAP - writer_.pos);
+            func(&writer_.tail->nodes[writer_.pos], batch_size, std::forward<Args>(args)...);
+            writer_.tail->written.store(writer_.pos += batch_size, std::memory_order_release);
+            return batch_size;
+        }
+
+        if (reader_.pos == reader_.written && !refresh())
+            return 0;
+        auto const batch_size = std::min(BATCH_SIZE, reader_.written - reader_.pos);
+        func(&reader_.head->nodes[reader_.pos], batch_size, std::forward<Args>(args)...);
+        reader_.pos += batch_size;
+        return batch_size;
+    }
+
+    /**
+     * Args are forwarded to the in-place c-tor of T
+     */
+    template <class... Args>
+    void put(Args&&... args)
+    {
+        invokev<true, 1>([&](node_t* node, size_t, Args&&... args) noexcept {
+            new(node)T(std::forward<Args>(args)...);
+        }, std::forward<Args>(args)...);
+    }
+
+    /**
+     * Callback signature: void (T&, Args...)
+     */
+    template <class F, class... Args>
+    bool take(F const& func, Args&&... args) {
+        return invokev<false, 1>([&](node_t* node, size_t, Args&&... args) noexcept {
+            T& val = reinterpret_cast<T&>(*node);
+            func(std::move(val), std::forward<Args>(args)...);
+            val.~T();
+        }, std::forward<Args>(args)...);
+    }
+
+    /** chunks allocated so far, writer side */
+    size_t allocated() const noexcept { return allocated_; }
+
+private:
+    /** writer side, the current chunk is full */
+    void link()
+    {
+        chunk* next = nullptr;
+        if (!spare_.take([&](chunk*&& c) noexcept { next = c; }))
+        {
+            next = new chunk;
+            ++allocated_;
+        }
+        writer_.tail->next.store(next, std::memory_order_release);
+        writer_ = {next, 0};
+    }
+
+    /** reader side, caught up with the writer's count, false if nothing new */
+    bool refresh()
+    {
+        if (reader_.pos == CAP)
+        {
+            auto* const next = reader_.head->next.load(std::memory_order_acquire);
+            if (!next)
+                return false;
+
+            auto* const drained = reader_.head;
+            drained->written.store(0, std::memory_order_relaxed);
+            drained->next.store(nullptr, std::memory_order_relaxed);
+            if (!spare_.put(drained))
+                delete drained;
+            reader_ = {next, 0, 0};
+        }
+        reader_.written = reader_.head->written.load(std::memory_order_acquire);
+        return reader_.pos != reader_.written;
+    }
+
+    struct alignas(UFW_L1D_LINE_SIZE)
+    {
+        chunk* tail;
+        size_t pos;
+    } writer_;
+
+    size_t allocated_;
+
+    struct alignas(UFW_L1D_LINE_SIZE)
+    {
+        chunk* head;
+        size_t pos;
+        size_t written; // the writer's count as last seen
+    } reader_;
+
+    ringbuf<chunk*, SPARE + 1> spare_;
+}; // class spsc_queue
+
+} // namespace ufw
@@ -0,0 +1,436 @@
+/*
+   Copyright 2016 Vladimir Lysyy (mrbald@github)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "tsc_clock.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <emmintrin.h>
+
+#ifndef UFW_L1D_LINE_SIZE
+#   error "macro UFW_L1D_LINE_SIZE not defined"
+#endif
+
+namespace ufw {
+
+/**
+ * Open addressing hash map, one writer thread and any number of lock free readers,
+ * for small trivially copyable keys and values (symbol ids, book handles, reference data).
+ *
+ * Swiss table layout: the slots are flat, a control byte each, groups of 16 control
+ * bytes are matched against 7 bits of the hash with SSE2, a probe ends at a group
+ * with an empty slot. Erased slots become tombstones and are reused by inserts.
+ *
+ * A slot is a seqlock: the writer makes its sequence odd while rewriting it, a reader
+ * copies the key and the value out and retries on a torn copy. A control byte is
+ * published after its slot, so a reader matching it sees the slot written.
+ *
+ * Growth is incremental: past 7/8 of the capacity in use (tombstones included)
+ * a new table is allocated, twice the size unless the live entries would fit
+ * the same one, and every writer call moves MIGRATE_GROUPS groups of the old
+ * table over. Meanwhile readers look the key up in the old table, then in the new one,
+ * the writer inserts a moved entry in the new table before erasing it from the old one.
+ * A miss is retried if the current table was replaced during the lookup.
+ *
+ * A table a migration is done with is retired, readers may still be in it. A lookup
+ * counts itself in for its duration in one of READER_SLOTS counters (a slot per thread,
+ * round robin) of the parity of the current epoch. The writer moves the epoch on once
+ * no lookup of the parity before is left and frees a table two epochs after it was
+ * retired, checked on every writer call while there are tables retired. No lookup
+ * can be in it then. A reader that never leaves a lookup holds the reclamation, never
+ * a lookup, so the retired tables are bounded by how long the longest lookup takes.
+ */
+template <class K, class V, class Hash = std::hash<K>, class KeyEqual = std::equal_to<K>>
+class swmr_map
+{
+    static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value, "copied in and out word by word");
+
+    static constexpr size_t GROUP = 16;
+    static constexpr size_t MIGRATE_GROUPS = 2;
+    static constexpr size_t READER_SLOTS = 16;
+
+    static constexpr uint8_t EMPTY = 0x80;
+    static constexpr uint8_t DELETED = 0xfe;
+
+    static constexpr size_t KEY_WORDS = (sizeof(K) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    static constexpr size_t WORDS = KEY_WORDS + (sizeof(V) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    using words_t = std::array<uint64_t, WORDS>;
+
+    struct slot
+    {
+        std::atomic<uint64_t> seq {0};
+        std::array<std::atomic<uint64_t>, WORDS> words;
+    };
+
+    struct alignas(GROUP) group
+    {
+        std::array<std::atomic<uint64_t>, 2> ctrl {{0x8080808080808080ull, 0x8080808080808080ull}};
+    };
+
+    struct table
+    {
+        explicit table(size_t groups): mask(groups - 1), groups(new group[groups]), slots(new slot[groups * GROUP]) {}
+
+        size_t capacity() const noexcept { return (mask + 1) * GROUP; }
+
+        __m128i ctrl(size_t g) const noexcept
+        {
+            auto const& c = groups[g].ctrl;
+            return _mm_set_epi64x(int64_t(c[1].load(std::memory_order_acquire)), int64_t(c[0].load(std::memory_order_acquire)));
+        }
+
+        /** writer side, single writer */
+        void set_ctrl(size_t i, uint8_t x) noexcept
+        {
+            auto& word = groups[i / GROUP].ctrl[i % GROUP / 8];
+            auto const shift = 8 * (i % 8);
+            word.store((word.load(std::memory_order_relaxed) & ~(0xffull << shift)) | uint64_t(x) << shift, std::memory_order_release);
+        }
+
+        size_t const mask; // groups - 1
+        std::unique_ptr<group[]> groups;
+        std::unique_ptr<slot[]> slots;
+        size_t used = 0; // full and deleted, writer side
+    };
+
+    /** lookups in progress, by epoch parity */
+    struct alignas(UFW_L1D_LINE_SIZE) readers
+    {
+        std::array<std::atomic<uint64_t>, 2> active {{0, 0}};
+    };
+
+    /** counts a lookup in for its scope, the table pointers are loaded after */
+    class reader_guard
+    {
+    public:
+        explicit reader_guard(swmr_map const& map) noexcept:
+            active_(map.readers_[slot()].active[map.epoch_.load(std::memory_order_relaxed) & 1])
+        {
+            active_.fetch_add(1, std::memory_order_seq_cst);
+        }
+
+        ~reader_guard() { active_.fetch_sub(1, std::memory_order_release); }
+
+    private:
+        static size_t slot() noexcept
+        {
+            static std::atomic<size_t> next {0};
+            thread_local size_t const slot = next.fetch_add(1, std::memory_order_relaxed) % READER_SLOTS;
+            return slot;
+        }
+
+        std::atomic<uint64_t>& active_;
+    };
+
+public:
+    explicit swmr_map(size_t capacity = GROUP) { tables_.emplace_back(new table(groups_for(capacity))); cur_ = tables_.back().get(); }
+
+    swmr_map(swmr_map const&) = delete;
+    swmr_map& operator=(swmr_map const&) = delete;
+
+    /** reader side, any thread */
+    bool find(K const& key, V& out) const noexcept
+    {
+        auto const h = hash_of(key);
+        reader_guard const _(*this);
+        for (;;)
+        {
+            // seq_cst, ordered after the count in against the writer retiring a table
+            auto const* cur = cur_.load();
+            auto const* old = old_.load();
+            if (old && old != cur && find_in(*old, key, h, out))
+                return true;
+            if (find_in(*cur, key, h, out))
+                return true;
+            if (cur_.load(std::memory_order_acquire) == cur)
+                return false;
+        }
+    }
+
+    bool contains(K const& key) const noexcept
+    {
+        V ignored;
+        return find(key, ignored);
+    }
+
+    /** number of entries, exact on the writer side */
+    size_t size() const noexcept { return size_.load(std::memory_order_relaxed); }
+
+    /**
+     * Writer side.
+     * @return true if inserted, false if assigned
+     */
+    bool insert_or_assign(K const& key, V const& value)
+    {
+        migrate();
+        auto const h = hash_of(key);
+        for (auto* t: {old_.load(std::memory_order_relaxed), cur_.load(std::memory_order_relaxed)})
+        {
+            if (!t)
+                continue;
+            auto const i = lookup(*t, key, h);
+            if (i != NPOS)
+            {
+                write(t->slots[i], key, value);
+                return false;
+            }
+        }
+
+        auto* t = cur_.load(std::memory_order_relaxed);
+        if (!old_.load(std::memory_order_relaxed) && (t->used + 1) * 8 > t->capacity() * 7)
+        {
+            grow();
+            t = cur_.load(std::memory_order_relaxed);
+        }
+        place(*t, key, value, h);
+        size_.store(size() + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * Writer side.
+     * @return true if erased
+     */
+    bool erase(K const& key) noexcept
+    {
+        migrate();
+        auto const h = hash_of(key);
+        for (auto* t: {old_.load(std::memory_order_relaxed), cur_.load(std::memory_order_relaxed)})
+        {
+            if (!t)
+                continue;
+            auto const i = lookup(*t, key, h);
+            if (i != NPOS)
+            {
+                t->set_ctrl(i, DELETED);
+                size_.store(size() - 1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** writer side, frees the retired tables no lookup can be in any more, done by every writer call too */
+    void reclaim() noexcept
+    {
+        auto epoch = epoch_.load(std::memory_order_relaxed);
+        bool drained = true;
+        for (auto const& r: readers_)
+            drained &= !r.active[(epoch + 1) & 1].load(std::memory_order_seq_cst);
+        if (drained)
+            epoch_.store(++epoch, std::memory_order_seq_cst);
+
+        auto const done = std::find_if(retired_.begin(), retired_.end(), [epoch](auto const& r) { return r.first + 2 > epoch; });
+        retired_.erase(retired_.begin(), done);
+    }
+
+    /** writer side, number of tables retired and not freed yet */
+    size_t retired() const noexcept { return retired_.size(); }
+
+private:
+    static constexpr size_t NPOS = ~size_t(0);
+
+    static size_t groups_for(size_t capacity) noexcept
+    {
+        size_t groups = 1;
+        while (groups * GROUP * 7 < capacity * 8)
+            groups *= 2;
+        return groups;
+    }
+
+    static uint64_t hash_of(K const& key) noexcept
+    {
+        // murmur3 finalizer, std::hash of an integer is the identity
+        uint64_t h = Hash()(key);
+        h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdull;
+        h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ull;
+        return h ^ (h >> 33);
+    }
+
+    static unsigned match(__m128i ctrl, uint8_t x) noexcept { return unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(char(x))))); }
+
+    /** triangular probing, visits every group of a power of two */
+    template <class F>
+    static size_t probe(table const& t, uint64_t h, F&& f) noexcept
+    {
+        for (size_t g = (h >> 7) & t.mask, i = 0; i <= t.mask; g = (g + ++i) & t.mask)
+        {
+            auto const ctrl = t.ctrl(g);
+            auto const found = f(g, ctrl);
+            if (found != NPOS)
+                return found;
+            if (match(ctrl, EMPTY))
+                return NPOS;
+        }
+        return NPOS;
+    }
+
+    static bool find_in(table const& t, K const& key, uint64_t h, V& out) noexcept
+    {
+        return probe(t, h, [&](size_t g, __m128i ctrl)
+        {
+            for (auto bits = match(ctrl, uint8_t(h & 0x7f)); bits; bits &= bits - 1)
+            {
+                K k;
+                V v;
+                auto const i = g * GROUP + __builtin_ctz(bits);
+                read(t.slots[i], k, v);
+                if (KeyEqual()(k, key))
+                {
+                    out = v;
+                    return i;
+                }
+            }
+            return NPOS;
+        }) != NPOS;
+    }
+
+    /** writer side */
+    static size_t lookup(table const& t, K const& key, uint64_t h) noexcept
+    {
+        return probe(t, h, [&](size_t g, __m128i ctrl)
+        {
+            for (auto bits = match(ctrl, uint8_t(h & 0x7f)); bits; bits &= bits - 1)
+            {
+                auto const i = g * GROUP + __builtin_ctz(bits);
+                words_t buf;
+                for (size_t w = 0; w < KEY_WORDS; ++w)
+                    buf[w] = t.slots[i].words[w].load(std::memory_order_relaxed);
+                K k;
+                std::memcpy(&k, buf.data(), sizeof(K));
+                if (KeyEqual()(k, key))
+                    return i;
+            }
+            return NPOS;
+        });
+    }
+
+    /** writer side, a key not in the table to the first empty or deleted slot of its probe sequence */
+    static void place(table& t, K const& key, V const& value, uint64_t h) noexcept
+    {
+        for (size_t g = (h >> 7) & t.mask, i = 0;; g = (g + ++i) & t.mask)
+        {
+            auto const ctrl = t.ctrl(g);
+            if (auto const free = unsigned(_mm_movemask_epi8(ctrl))) // EMPTY and DELETED have the top bit
+            {
+                auto const at = g * GROUP + __builtin_ctz(free);
+                t.used += match(ctrl, EMPTY) >> (at % GROUP) & 1;
+                write(t.slots[at], key, value);
+                t.set_ctrl(at, uint8_t(h & 0x7f));
+                return;
+            }
+        }
+    }
+
+    static void read(slot const& s, K& key, V& value) noexcept
+    {
+        words_t buf;
+        for (;;)
+        {
+            auto const seq = s.seq.load(std::memory_order_acquire);
+            if (!(seq & 1))
+            {
+                for (size_t i = 0; i < WORDS; ++i)
+                    buf[i] = s.words[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (s.seq.load(std::memory_order_relaxed) == seq)
+                    break;
+            }
+            zzz();
+        }
+        std::memcpy(&key, buf.data(), sizeof(K));
+        std::memcpy(&value, buf.data() + KEY_WORDS, sizeof(V));
+    }
+
+    static void write(slot& s, K const& key, V const& value) noexcept
+    {
+        words_t buf {};
+        std::memcpy(buf.data(), &key, sizeof(K));
+        std::memcpy(buf.data() + KEY_WORDS, &value, sizeof(V));
+
+        auto const seq = s.seq.load(std::memory_order_relaxed);
+        s.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; ++i)
+            s.words[i].store(buf[i], std::memory_order_relaxed);
+        s.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    void grow()
+    {
+        auto* const old = cur_.load(std::memory_order_relaxed);
+        auto const groups = (old->mask + 1) * (2 * (size() + 1) > old->capacity() ? 2 : 1); // or just the tombstones out
+        tables_.emplace_back(new table(groups));
+        migrated_ = 0;
+        old_.store(old, std::memory_order_release);
+        cur_.store(tables_.back().get(), std::memory_order_release); // before any entry is moved
+    }
+
+    /** moves the next MIGRATE_GROUPS groups of the old table, if any */
+    void migrate() noexcept
+    {
+        if (!retired_.empty())
+            reclaim();
+
+        auto* const old = old_.load(std::memory_order_relaxed);
+        if (!old)
+            return;
+
+        auto& cur = *cur_.load(std::memory_order_relaxed);
+        for (auto const end = std::min(migrated_ + MIGRATE_GROUPS, old->mask + 1); migrated_ < end; ++migrated_)
+        {
+            for (auto bits = ~unsigned(_mm_movemask_epi8(old->ctrl(migrated_))) & 0xffff; bits; bits &= bits - 1)
+            {
+                auto const i = migrated_ * GROUP + __builtin_ctz(bits);
+                K key;
+                V value;
+                read(old->slots[i], key, value);
+                place(cur, key, value, hash_of(key));
+                old->set_ctrl(i, DELETED);
+            }
+        }
+
+        if (migrated_ > old->mask)
+        {
+            old_.store(nullptr, std::memory_order_seq_cst);
+            retired_.emplace_back(epoch_.load(std::memory_order_relaxed), std::move(tables_.front()));
+            tables_.erase(tables_.begin());
+        }
+    }
+
+    std::atomic<table*> cur_ {nullptr};
+    std::atomic<table*> old_ {nullptr};
+    std::atomic<size_t> size_ {0};
+    size_t migrated_ = 0; // groups of the old table moved
+    std::vector<std::unique_ptr<table>> tables_; // the old one while migrating, the current one last
+
+    std::atomic<uint64_t> epoch_ {0};
+    mutable std::array<readers, READER_SLOTS> readers_; // counted in by the const lookups
+    std::vector<std::pair<uint64_t, std::unique_ptr<table>>> retired_; // with the epoch of the retirement
+}; // class swmr_map
+
+} // namespace ufw
@@ -95,6 +95,18 @@ auto tsc_cast(uint64_t ticks) noexcept
     return duration_type {static_cast<typename duration_type::rep>(ticks * ratio.second / ratio.first)};
 }
 
+/**
+ * The other way round, a duration to TSC ticks, scaled with the tsc_clock ratio
+ * (picoseconds) so that no other calibration is run.
+ */
+template <class Rep, class Period> inline
+uint64_t tsc_ticks(std::chrono::duration<Rep, Period> d) noexcept
+{
+    using pico = std::chrono::duration<double, std::pico>;
+    auto const ratio = tsc_ratio<pico>();
+    return static_cast<uint64_t>(std::chrono::duration_cast<pico>(d).count() * ratio.first / ratio.second);
+}
+
 // Original idea by http://stackoverflow.com/a/11485388/267482
 /**
  * TSC based clock usable for measuring deltas.
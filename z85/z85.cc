@@ -16,39 +16,91 @@
    limitations under the License.
 */
 
-#include <boost/endian/arithmetic.hpp>
-#include <boost/integer.hpp>
-
 #include <cstdint>
+#include <cstring>
+#include <iterator>
 #include <utility>
 #include <array>
 #include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#endif
 
 namespace z85
 {
 
 using uchar_t = unsigned char;
 
-namespace
+using cursor_t = std::pair<uchar_t const*, uchar_t*>;
+
+/* a character out of the alphabet in the checked decode tables */
+constexpr uint8_t INVALID = 0xff;
+
+/*
+ * Alphabets:
+ *   the digits in order, bytes in and characters out per group, the pad character of padding::padded (0 - none)
+ *
+ * The digits are ASCII, the decode tables and the SIMD lookups take it so.
+ */
+struct z85_alphabet
 {
+    static constexpr char const* digits() noexcept { return "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#"; }
+    static constexpr size_t bytes = 4, chars = 5;
+    static constexpr uchar_t pad = 0;
+};
 
-uchar_t const en_codes[]{"0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ.-:+=^!/*?&<>()[]{}@%$#"};
+/* btoa/Adobe digits, without the 'z' shorthand and the <~ ~> delimiters */
+struct ascii85_alphabet
+{
+    static constexpr char const* digits() noexcept { return "!\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstu"; }
+    static constexpr size_t bytes = 4, chars = 5;
+    static constexpr uchar_t pad = 0;
+};
 
-std::array<uint8_t, std::numeric_limits<uint8_t>::max() + 1> const de_codes = []
+/* RFC 4648 */
+struct base64_alphabet
+{
+    static constexpr char const* digits() noexcept { return "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"; }
+    static constexpr size_t bytes = 3, chars = 4;
+    static constexpr uchar_t pad = '=';
+};
+
+struct base64url_alphabet
+{
+    static constexpr char const* digits() noexcept { return "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_"; }
+    static constexpr size_t bytes = 3, chars = 4;
+    static constexpr uchar_t pad = '=';
+};
+
+struct base32_alphabet
+{
+    static constexpr char const* digits() noexcept { return "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567"; }
+    static constexpr size_t bytes = 5, chars = 8;
+    static constexpr uchar_t pad = '=';
+};
+
+/* lower case only */
+struct hex_alphabet
+{
+    static constexpr char const* digits() noexcept { return "0123456789abcdef"; }
+    static constexpr size_t bytes = 1, chars = 2;
+    static constexpr uchar_t pad = 0;
+};
+
+namespace
 {
-    std::array<uint8_t, std::numeric_limits<uint8_t>::max() + 1> x{};
-    for (uint8_t i = 0; i < sizeof(en_codes) - 1; ++i)
-    {
-        x[en_codes[i]] = i;
-    }
-    return x;
-}();
 
 constexpr inline
-uint32_t cpow(uint32_t base, uint8_t exp) noexcept
+uint64_t cpow(uint64_t base, uint8_t exp) noexcept
 {
     return (exp == 0) ? 1:
-        (exp % 2 == 0) ? 
+        (exp % 2 == 0) ?
                 cpow(base, exp / 2) * cpow(base, exp / 2):
                 base * cpow(base, (exp - 1) / 2) * cpow(base, (exp - 1) / 2);
 }
@@ -57,60 +109,965 @@ template <class X> inline
 constexpr X sum(X&& x) noexcept { return std::forward<X>(x); }
 
 template <class X, class... Xs> inline
-constexpr 
+constexpr
 std::enable_if_t<!!sizeof...(Xs), std::common_type_t<X, Xs...>> sum(X&& x, Xs&&... xs) noexcept { return x + sum(std::forward<Xs>(xs)...); }
 
-/* 
+constexpr inline
+size_t length(char const* s) noexcept { return *s ? 1 + length(s + 1) : 0; }
+
+/* bit c >> 4 of [c & 15] is set for the digits [first, last) */
+using bitmap_t = std::array<uchar_t, 16>;
+
+template <class Alphabet>
+constexpr bitmap_t bitmap_of(size_t first, size_t last) noexcept
+{
+    bitmap_t x{};
+    for (size_t i = first; i < last; ++i)
+        x[Alphabet::digits()[i] & 15] |= 1 << (Alphabet::digits()[i] >> 4);
+    return x;
+}
+
+/* digit ==> character, zero padded for the SIMD lookups */
+template <class Alphabet>
+constexpr std::array<uchar_t, 128> en_codes_of() noexcept
+{
+    std::array<uchar_t, 128> x{};
+    for (size_t i = 0; i < length(Alphabet::digits()); ++i)
+        x[i] = Alphabet::digits()[i];
+    return x;
+}
+
+/* character ==> digit, invalid for the characters out of the alphabet */
+template <class Alphabet>
+constexpr std::array<uint8_t, 256> de_codes_of(uint8_t invalid) noexcept
+{
+    std::array<uint8_t, 256> x{};
+    for (auto& d : x)
+        d = invalid;
+    for (size_t i = 0; i < length(Alphabet::digits()); ++i)
+        x[uchar_t(Alphabet::digits()[i])] = uint8_t(i);
+    return x;
+}
+
+template <class Alphabet>
+constexpr bool ascii_and_unique() noexcept
+{
+    auto const digits = Alphabet::digits();
+    for (size_t i = 0; digits[i]; ++i)
+    {
+        if (uchar_t(digits[i]) >= 0x80 || digits[i] == Alphabet::pad)
+            return false;
+        for (size_t j = 0; j < i; ++j)
+            if (digits[j] == digits[i])
+                return false;
+    }
+    return true;
+}
+
+} // local namespace
+
+/*
+ * A radix codec generated from the alphabet at compile time:
+ *   bytes ==> big endian number ==> chars digits of base, most significant first
+ *
+ * Z85 and Ascii85 divide by powers of 85, base64, base32 and hex are the same with powers of two.
+ */
+template <class Alphabet>
+struct radix
+{
+    static constexpr size_t base = length(Alphabet::digits());
+    static constexpr size_t bytes = Alphabet::bytes;
+    static constexpr size_t chars = Alphabet::chars;
+    static constexpr uchar_t pad = Alphabet::pad;
+
+    /* bits per digit of a power of two base, 0 for the others */
+    static constexpr unsigned bits = (base & (base - 1)) ? 0 : __builtin_ctzll(base);
+
+    using word_t = std::conditional_t<(bytes > 4), uint64_t, uint32_t>;
+
+    static_assert(ascii_and_unique<Alphabet>(), "digits must be unique ASCII characters other than pad");
+    static_assert(bytes < 8 && cpow(base, chars) >= uint64_t(1) << 8 * bytes && cpow(base, chars - 1) < uint64_t(1) << 8 * bytes,
+            "chars digits must take exactly bytes bytes");
+
+    static constexpr std::array<uchar_t, 128> en_codes = en_codes_of<Alphabet>();
+    static constexpr std::array<uint8_t, 256> de_codes = de_codes_of<Alphabet>(0); // unchecked decoding takes anything for a 0
+    static constexpr std::array<uint8_t, 256> de_digits = de_codes_of<Alphabet>(INVALID);
+
+    static constexpr bitmap_t alphabet_bitmap = bitmap_of<Alphabet>(0, base);
+    static constexpr bitmap_t overflow_bitmap = bitmap_of<Alphabet>(bits ? base : 82, base); // leading digits of the base 85 groups over 0xffffffff
+
+    static constexpr word_t power(size_t exp) noexcept { return word_t(cpow(base, uint8_t(exp))); }
+
+    /* digits for the first k < bytes bytes of a group */
+    static constexpr size_t partial_chars(size_t k) noexcept
+    {
+        size_t c = 0;
+        while (k && cpow(base, uint8_t(c)) < uint64_t(1) << 8 * k)
+            ++c;
+        return c;
+    }
+
+    /* the most bytes of a group c digits take */
+    static constexpr size_t partial_bytes(size_t c) noexcept
+    {
+        size_t k = 0;
+        while (k + 1 < bytes && partial_chars(k + 1) <= c)
+            ++k;
+        return k;
+    }
+
+    static word_t load(uchar_t const* in) noexcept
+    {
+        word_t val = 0;
+        for (size_t i = 0; i < bytes; ++i)
+            val = word_t(val << 8 | in[i]);
+        return val;
+    }
+
+    static void store(word_t val, uchar_t* out) noexcept
+    {
+        for (size_t i = bytes; i--; val = word_t(val >> 8))
+            out[i] = uchar_t(val);
+    }
+};
+
+namespace
+{
+
+/*
  * Encoder implementation code:
- *   uint32_t (native byte order) ==> array<uchar,5>
+ *   word_t (native byte order) ==> array<uchar,chars>
  */
-template <size_t base, size_t N, size_t... Is> inline
-std::array<uchar_t, sizeof...(Is)> _encode(uint32_t val, std::index_sequence<Is...>) noexcept
+template <class R, size_t... Is> inline
+std::array<uchar_t, sizeof...(Is)> _encode(typename R::word_t val, std::index_sequence<Is...>) noexcept
 {
-    uint32_t buf{};
-    return { en_codes[buf = (val -= buf * cpow(base, N - Is)) / cpow(base, N - Is - 1)] ... };
+    constexpr size_t N = sizeof...(Is);
+    typename R::word_t buf{};
+    return { R::en_codes[buf = (val -= buf * R::power(N - Is)) / R::power(N - Is - 1)] ... };
 }
 
-template <size_t base, size_t N> inline
-std::array<uchar_t, N> _encode(uint32_t val) noexcept { return _encode<base, N>(val, std::make_index_sequence<N>()); }
+template <class R> inline
+std::array<uchar_t, R::chars> _encode(typename R::word_t val) noexcept { return _encode<R>(val, std::make_index_sequence<R::chars>()); }
 
 
-/* 
+/*
  * Decoder implementation code:
- *   array<uchar,5> ==> uint32_t (native byte order)
+ *   array<uchar,chars> ==> word_t (native byte order)
  */
-template <size_t base, size_t N, size_t... Is> inline
-uint32_t _decode(std::array<uchar_t, N> const& val, std::index_sequence<Is...>) noexcept
+template <class R, size_t... Is> inline
+typename R::word_t _decode(uchar_t const* val, std::index_sequence<Is...>) noexcept
 {
-    return sum(de_codes[val[Is]] * cpow(base, N - Is - 1)...);
+    return sum(typename R::word_t(R::de_codes[val[Is]]) * R::power(sizeof...(Is) - Is - 1)...);
 }
 
-template <size_t base, size_t N> inline
-uint32_t _decode(std::array<uchar_t, N> const& val) noexcept { return _decode<base, N>(val, std::make_index_sequence<N>()); }
-
-using boost::endian::big_uint32_t;
+template <class R> inline
+typename R::word_t _decode(uchar_t const* val) noexcept { return _decode<R>(val, std::make_index_sequence<R::chars>()); }
 
 } // local namespace
 
-using cursor_t = std::pair<uchar_t const*, uchar_t*>;
+/* one group of the codec */
+template <class Alphabet> inline
+cursor_t encode(cursor_t locs) noexcept
+{
+    using R = radix<Alphabet>;
+    auto encoded = _encode<R>(R::load(locs.first));
+    std::copy_n(encoded.begin(), R::chars, locs.second);
+    return {locs.first + R::bytes, locs.second + R::chars};
+}
+
+template <class Alphabet> inline
+cursor_t decode(cursor_t locs) noexcept
+{
+    using R = radix<Alphabet>;
+    R::store(_decode<R>(locs.first), locs.second);
+    return {locs.first + R::chars, locs.second + R::bytes};
+}
 
 template <size_t base, size_t N> inline
 cursor_t encode(cursor_t locs) noexcept
 {
-    auto encoded = _encode<base, N>((big_uint32_t&)(*locs.first));
-    std::copy_n(encoded.begin(), N, locs.second);
-    return {locs.first + sizeof(big_uint32_t), locs.second + N};
+    static_assert(base == 85 && N == 5, "encode<Alphabet> for the other codecs");
+    return encode<z85_alphabet>(locs);
 }
 
 template <size_t base, size_t N> inline
 cursor_t decode(cursor_t locs) noexcept
 {
-    std::array<uchar_t, N> buf;
-    std::copy_n(locs.first, N, buf.begin());
-    ((big_uint32_t&)(*locs.second)) = _decode<base, N>(buf);
-    return {locs.first + N, locs.second + sizeof(big_uint32_t)};
+    static_assert(base == 85 && N == 5, "decode<Alphabet> for the other codecs");
+    return decode<z85_alphabet>(locs);
 }
 
+/*
+ * Bulk codecs:
+ *   n groups, bytes * n bytes <==> chars * n characters, the same as n calls of encode/decode<Alphabet>
+ *
+ * The SIMD kernels take 8 (AVX2) or 16 (AVX-512) groups of base 85 per iteration, the tail goes to the scalar
+ * template. Division by powers of 85 is a multiply by the reciprocal: v / 85^2 is (v * 0x9121b243) >> 44
+ * in 64 bit lanes, exact for any 32 bit v, which leaves two numbers below 85^2, x / 85 of those is
+ * (x * 49345) >> 22 in 16 bit lanes. The character tables are looked up 16 entries at a time
+ * with pshufb (AVX2) or all 128 at once with vpermi2b (AVX-512 VBMI).
+ * Decoding does the reverse with pmaddubsw/pmaddwd. find_invalid() tests characters against
+ * a bitmap of the alphabet, indexed with pshufb by the low nibble, a bit per high nibble.
+ *
+ * The power of two bases have a single AVX-512 VBMI kernel: 8 digits of b bits are b bytes, one per
+ * 64 bit lane, vpmultishiftqb cuts them out, vpermb looks them up. Decoding packs the digits with
+ * pmaddubsw/pmaddwd and a shift.
+ */
+struct bulk_codec
+{
+    char const* isa;
+    bool (*supported)();
+    cursor_t (*encode)(cursor_t, size_t);
+    cursor_t (*decode)(cursor_t, size_t);
+    /* whole groups: the first character out of the alphabet or base 85 group that may be over 0xffffffff */
+    uchar_t const* (*find_invalid)(uchar_t const* first, uchar_t const* last);
+};
+
+namespace
+{
+
+template <class Alphabet>
+cursor_t encode_scalar(cursor_t locs, size_t n) noexcept
+{
+    while (n--)
+        locs = encode<Alphabet>(locs);
+    return locs;
+}
+
+template <class Alphabet>
+cursor_t decode_scalar(cursor_t locs, size_t n) noexcept
+{
+    while (n--)
+        locs = decode<Alphabet>(locs);
+    return locs;
+}
+
+template <class Alphabet>
+uchar_t const* find_invalid_scalar(uchar_t const* first, uchar_t const* last) noexcept
+{
+    using R = radix<Alphabet>;
+    if (R::bits)
+        return std::find_if(first, last, [](uchar_t c) { return R::de_digits[c] == INVALID; });
+
+    for (; first != last; first += 5)
+    {
+        if (R::de_digits[first[0]] >= 82) // the top 3 digits and out of the alphabet
+            return first;
+        for (size_t i = 1; i < 5; ++i)
+            if (R::de_digits[first[i]] == INVALID)
+                return first + i;
+    }
+    return last;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+bool has_avx2() noexcept
+{
+    return __builtin_cpu_init(), __builtin_cpu_supports("avx2");
+}
+
+bool has_avx512vbmi() noexcept
+{
+    return __builtin_cpu_init(), __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi");
+}
+
+/*
+ * AVX2 kernels
+ */
+__attribute__((target("avx2"))) inline
+__m256i lookup_avx2(uchar_t const* table, __m256i idx) noexcept
+{
+    auto const row = _mm256_and_si256(_mm256_srli_epi16(idx, 4), _mm256_set1_epi8(0x0f));
+    auto const col = _mm256_and_si256(idx, _mm256_set1_epi8(0x0f));
+    auto res = _mm256_setzero_si256();
+    for (int i = 0; i < 6; ++i)
+    {
+        auto const rows = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)(table + 16 * i)));
+        auto const hit = _mm256_cmpeq_epi8(row, _mm256_set1_epi8(char(i)));
+        res = _mm256_or_si256(res, _mm256_and_si256(_mm256_shuffle_epi8(rows, col), hit));
+    }
+    return res;
+}
+
+__attribute__((target("avx2"))) inline
+__m256i div7225_avx2(__m256i v) noexcept
+{
+    auto const m = _mm256_set1_epi32(int(0x9121b243));
+    auto const even = _mm256_srli_epi64(_mm256_mul_epu32(v, m), 44);
+    auto const odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(v, 32), m), 44);
+    return _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xaa);
+}
+
+template <class Alphabet> __attribute__((target("avx2")))
+cursor_t encode_avx2(cursor_t locs, size_t n) noexcept
+{
+    auto const en_codes = radix<Alphabet>::en_codes.data();
+    auto const bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    // a lane has 4 words: [d0 d1 d2 d3] x 4 in a, d4 in the low bytes of b, 20 characters out
+    auto const head_a = _mm256_setr_epi8(
+            0, 1, 2, 3, -1, 4, 5, 6, 7, -1, 8, 9, 10, 11, -1, 12,
+            0, 1, 2, 3, -1, 4, 5, 6, 7, -1, 8, 9, 10, 11, -1, 12);
+    auto const head_b = _mm256_setr_epi8(
+            -1, -1, -1, -1, 0, -1, -1, -1, -1, 4, -1, -1, -1, -1, 8, -1,
+            -1, -1, -1, -1, 0, -1, -1, -1, -1, 4, -1, -1, -1, -1, 8, -1);
+    auto const tail_a = _mm256_setr_epi8(
+            13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    auto const tail_b = _mm256_setr_epi8(
+            -1, -1, -1, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+
+    for (; n >= 8; n -= 8, locs.first += 32, locs.second += 40)
+    {
+        auto const v = _mm256_shuffle_epi8(_mm256_loadu_si256((__m256i const*)locs.first), bswap);
+
+        auto const hi = div7225_avx2(v); // d0 d1 d2
+        auto const lo = _mm256_sub_epi32(v, _mm256_mullo_epi32(hi, _mm256_set1_epi32(7225))); // d3 d4
+        auto const d0 = div7225_avx2(hi);
+        auto const mid = _mm256_sub_epi32(hi, _mm256_mullo_epi32(d0, _mm256_set1_epi32(7225))); // d1 d2
+
+        auto const x = _mm256_or_si256(mid, _mm256_slli_epi32(lo, 16));
+        auto const q = _mm256_srli_epi16(_mm256_mulhi_epu16(x, _mm256_set1_epi16(int16_t(49345))), 6); // d1, d3
+        auto const r = _mm256_sub_epi16(x, _mm256_mullo_epi16(q, _mm256_set1_epi16(85))); // d2, d4
+
+        auto const a = lookup_avx2(en_codes, _mm256_or_si256(_mm256_or_si256(d0, _mm256_slli_epi32(q, 8)), _mm256_slli_epi32(r, 16)));
+        auto const b = lookup_avx2(en_codes, _mm256_srli_epi32(r, 16));
+
+        auto const head = _mm256_or_si256(_mm256_shuffle_epi8(a, head_a), _mm256_shuffle_epi8(b, head_b));
+        auto const tail = _mm256_or_si256(_mm256_shuffle_epi8(a, tail_a), _mm256_shuffle_epi8(b, tail_b));
+
+        _mm_storeu_si128((__m128i*)locs.second, _mm256_castsi256_si128(head));
+        _mm_storeu_si32(locs.second + 16, _mm256_castsi256_si128(tail));
+        _mm_storeu_si128((__m128i*)(locs.second + 20), _mm256_extracti128_si256(head, 1));
+        _mm_storeu_si32(locs.second + 36, _mm256_extracti128_si256(tail, 1));
+    }
+    return encode_scalar<Alphabet>(locs, n);
+}
+
+template <class Alphabet> __attribute__((target("avx2")))
+cursor_t decode_avx2(cursor_t locs, size_t n) noexcept
+{
+    auto const de_codes = radix<Alphabet>::de_codes.data() + 32; // the printable range
+    auto const bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    // a lane has 20 characters: 16 in x, 4 in y, back to [d0 d1 d2 d3] x 4 in a and d4 x 4 in b
+    auto const a_x = _mm256_setr_epi8(
+            0, 1, 2, 3, 5, 6, 7, 8, 10, 11, 12, 13, 15, -1, -1, -1,
+            0, 1, 2, 3, 5, 6, 7, 8, 10, 11, 12, 13, 15, -1, -1, -1);
+    auto const a_y = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 1, 2,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 1, 2);
+    auto const b_x = _mm256_setr_epi8(
+            4, -1, -1, -1, 9, -1, -1, -1, 14, -1, -1, -1, -1, -1, -1, -1,
+            4, -1, -1, -1, 9, -1, -1, -1, 14, -1, -1, -1, -1, -1, -1, -1);
+    auto const b_y = _mm256_setr_epi8(
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 3, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 3, -1, -1, -1);
+    auto const printable = _mm256_set1_epi8(32);
+
+    for (; n >= 8; n -= 8, locs.first += 40, locs.second += 32)
+    {
+        int32_t y0, y1;
+        std::memcpy(&y0, locs.first + 16, sizeof(y0));
+        std::memcpy(&y1, locs.first + 36, sizeof(y1));
+
+        auto const x = lookup_avx2(de_codes, _mm256_sub_epi8(_mm256_loadu2_m128i((__m128i const*)(locs.first + 20), (__m128i const*)locs.first), printable));
+        auto const y = lookup_avx2(de_codes, _mm256_sub_epi8(_mm256_setr_epi32(y0, 0, 0, 0, y1, 0, 0, 0), printable));
+
+        auto const a = _mm256_or_si256(_mm256_shuffle_epi8(x, a_x), _mm256_shuffle_epi8(y, a_y));
+        auto const b = _mm256_or_si256(_mm256_shuffle_epi8(x, b_x), _mm256_shuffle_epi8(y, b_y));
+
+        auto const pairs = _mm256_maddubs_epi16(a, _mm256_set1_epi16(1 << 8 | 85)); // d0 * 85 + d1, d2 * 85 + d3
+        auto const quads = _mm256_madd_epi16(pairs, _mm256_set1_epi32(1 << 16 | 7225));
+        auto const v = _mm256_add_epi32(_mm256_mullo_epi32(quads, _mm256_set1_epi32(85)), b);
+
+        _mm256_storeu_si256((__m256i*)locs.second, _mm256_shuffle_epi8(v, bswap));
+    }
+    return decode_scalar<Alphabet>(locs, n);
+}
+
+/* the bytes of c in the bitmap */
+__attribute__((target("avx2"))) inline
+unsigned in_bitmap_avx2(bitmap_t const& bitmap, __m256i c) noexcept
+{
+    auto const bits = _mm256_setr_epi8(
+            1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+            1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    auto const nibble = _mm256_set1_epi8(0x0f);
+    auto const row = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i const*)bitmap.data())), _mm256_and_si256(c, nibble));
+    auto const bit = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(c, 4), nibble)); // none above 0x7f
+    return ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(row, bit), _mm256_setzero_si256())));
+}
+
+template <class Alphabet> __attribute__((target("avx2")))
+uchar_t const* find_invalid_avx2(uchar_t const* first, uchar_t const* last) noexcept
+{
+    using R = radix<Alphabet>;
+    // 8 groups, 32 characters in x, the last 8 at the top of y
+    unsigned const x_leads = 0x42108421, y_leads = 0x08000000, y_tail = 0xff000000;
+
+    for (; last - first >= 40; first += 40)
+    {
+        auto const x = _mm256_loadu_si256((__m256i const*)first);
+        auto const y = _mm256_loadu_si256((__m256i const*)(first + 8));
+        auto const x_bad = ~in_bitmap_avx2(R::alphabet_bitmap, x) | (in_bitmap_avx2(R::overflow_bitmap, x) & x_leads);
+        auto const y_bad = (~in_bitmap_avx2(R::alphabet_bitmap, y) | (in_bitmap_avx2(R::overflow_bitmap, y) & y_leads)) & y_tail;
+        if (x_bad)
+            return first + __builtin_ctz(x_bad);
+        if (y_bad)
+            return first + 8 + __builtin_ctz(y_bad);
+    }
+    return find_invalid_scalar<Alphabet>(first, last);
+}
+
+/*
+ * AVX-512 kernels
+ */
+#define Z85_AVX512 __attribute__((target("avx512f,avx512bw,avx512vbmi")))
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized" // _mm512_undefined_epi32() in the unmasked intrinsics
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+/* output character j of 16 words, j < 80: [d0 d1 d2 d3] x 16 in the first source, d4 in the second */
+constexpr std::array<uchar_t, 128> en_interleave = []
+{
+    std::array<uchar_t, 128> x{};
+    for (uchar_t j = 0; j < 80; ++j)
+        x[j] = j % 5 < 4 ? j / 5 * 4 + j % 5 : 64 + j / 5 * 4;
+    return x;
+}();
+
+Z85_AVX512 inline
+__m512i lookup_avx512(uchar_t const* table, __m512i idx) noexcept
+{
+    return _mm512_permutex2var_epi8(_mm512_loadu_si512(table), idx, _mm512_loadu_si512(table + 64));
+}
+
+Z85_AVX512 inline
+__m512i div7225_avx512(__m512i v) noexcept
+{
+    auto const m = _mm512_set1_epi32(int(0x9121b243));
+    auto const even = _mm512_srli_epi64(_mm512_mul_epu32(v, m), 44);
+    auto const odd = _mm512_srli_epi64(_mm512_mul_epu32(_mm512_srli_epi64(v, 32), m), 44);
+    return _mm512_mask_blend_epi32(0xaaaa, even, _mm512_slli_epi64(odd, 32));
+}
+
+template <class Alphabet> Z85_AVX512
+cursor_t encode_avx512(cursor_t locs, size_t n) noexcept
+{
+    auto const en_codes = radix<Alphabet>::en_codes.data();
+    auto const bswap = _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203);
+    auto const head = _mm512_loadu_si512(en_interleave.data());
+    auto const tail = _mm512_loadu_si512(en_interleave.data() + 64);
+
+    for (; n >= 16; n -= 16, locs.first += 64, locs.second += 80)
+    {
+        auto const v = _mm512_shuffle_epi8(_mm512_loadu_si512(locs.first), bswap);
+
+        auto const hi = div7225_avx512(v);
+        auto const lo = _mm512_sub_epi32(v, _mm512_mullo_epi32(hi, _mm512_set1_epi32(7225)));
+        auto const d0 = div7225_avx512(hi);
+        auto const mid = _mm512_sub_epi32(hi, _mm512_mullo_epi32(d0, _mm512_set1_epi32(7225)));
+
+        auto const x = _mm512_or_si512(mid, _mm512_slli_epi32(lo, 16));
+        auto const q = _mm512_srli_epi16(_mm512_mulhi_epu16(x, _mm512_set1_epi16(int16_t(49345))), 6);
+        auto const r = _mm512_sub_epi16(x, _mm512_mullo_epi16(q, _mm512_set1_epi16(85)));
+
+        auto const a = lookup_avx512(en_codes, _mm512_or_si512(_mm512_or_si512(d0, _mm512_slli_epi32(q, 8)), _mm512_slli_epi32(r, 16)));
+        auto const b = lookup_avx512(en_codes, _mm512_srli_epi32(r, 16));
+
+        _mm512_storeu_si512(locs.second, _mm512_permutex2var_epi8(a, head, b));
+        _mm512_mask_storeu_epi8(locs.second + 64, 0xffff, _mm512_permutex2var_epi8(a, tail, b));
+    }
+    return encode_scalar<Alphabet>(locs, n);
+}
+
+template <class Alphabet> Z85_AVX512
+cursor_t decode_avx512(cursor_t locs, size_t n) noexcept
+{
+    auto const de_codes = radix<Alphabet>::de_codes.data() + 32; // the printable range
+    auto const bswap = _mm512_set4_epi32(0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203);
+    // character 5 * w + k of 80, the first 64 in x, the rest in y
+    auto const a_idx = _mm512_set_epi32(
+            0x4e4d4c4b, 0x49484746, 0x44434241, 0x3f3e3d3c, 0x3a393837, 0x35343332, 0x302f2e2d, 0x2b2a2928,
+            0x26252423, 0x21201f1e, 0x1c1b1a19, 0x17161514, 0x1211100f, 0x0d0c0b0a, 0x08070605, 0x03020100);
+    auto const b_idx = _mm512_set_epi32(
+            0x4f, 0x4a, 0x45, 0x40, 0x3b, 0x36, 0x31, 0x2c, 0x27, 0x22, 0x1d, 0x18, 0x13, 0x0e, 0x09, 0x04);
+    auto const printable = _mm512_set1_epi8(32);
+    auto const t0 = _mm512_loadu_si512(de_codes);
+    auto const t1 = _mm512_loadu_si512(de_codes + 64);
+
+    for (; n >= 16; n -= 16, locs.first += 80, locs.second += 64)
+    {
+        // anything outside of the printable range is not a digit, 0 as de_codes has it
+        auto const cx = _mm512_sub_epi8(_mm512_loadu_si512(locs.first), printable);
+        auto const cy = _mm512_sub_epi8(_mm512_maskz_loadu_epi8(0xffff, locs.first + 64), printable);
+        auto const x = _mm512_maskz_permutex2var_epi8(_mm512_cmplt_epu8_mask(cx, _mm512_set1_epi8(96)), t0, cx, t1);
+        auto const y = _mm512_maskz_permutex2var_epi8(_mm512_cmplt_epu8_mask(cy, _mm512_set1_epi8(96)), t0, cy, t1);
+
+        auto const a = _mm512_permutex2var_epi8(x, a_idx, y);
+        auto const b = _mm512_maskz_permutex2var_epi8(0x1111111111111111, x, b_idx, y);
+
+        auto const pairs = _mm512_maddubs_epi16(a, _mm512_set1_epi16(1 << 8 | 85));
+        auto const quads = _mm512_madd_epi16(pairs, _mm512_set1_epi32(1 << 16 | 7225));
+        auto const v = _mm512_add_epi32(_mm512_mullo_epi32(quads, _mm512_set1_epi32(85)), b);
+
+        _mm512_storeu_si512(locs.second, _mm512_shuffle_epi8(v, bswap));
+    }
+    return decode_scalar<Alphabet>(locs, n);
+}
+
+Z85_AVX512 inline
+__mmask64 in_bitmap_avx512(bitmap_t const& bitmap, __m512i c) noexcept
+{
+    auto const bits = _mm512_broadcast_i32x4(_mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0));
+    auto const nibble = _mm512_set1_epi8(0x0f);
+    auto const row = _mm512_shuffle_epi8(_mm512_broadcast_i32x4(_mm_loadu_si128((__m128i const*)bitmap.data())), _mm512_and_si512(c, nibble));
+    auto const bit = _mm512_shuffle_epi8(bits, _mm512_and_si512(_mm512_srli_epi16(c, 4), nibble));
+    return _mm512_test_epi8_mask(row, bit);
+}
+
+template <class Alphabet> Z85_AVX512
+uchar_t const* find_invalid_avx512(uchar_t const* first, uchar_t const* last) noexcept
+{
+    using R = radix<Alphabet>;
+    // 16 groups, 64 characters in x, 16 in y
+    __mmask64 const x_leads = 0x1084210842108421, y_leads = 0x0842, y_tail = 0xffff;
+
+    for (; last - first >= 80; first += 80)
+    {
+        auto const x = _mm512_loadu_si512(first);
+        auto const y = _mm512_maskz_loadu_epi8(y_tail, first + 64);
+        auto const x_bad = ~in_bitmap_avx512(R::alphabet_bitmap, x) | (in_bitmap_avx512(R::overflow_bitmap, x) & x_leads);
+        auto const y_bad = (~in_bitmap_avx512(R::alphabet_bitmap, y) | (in_bitmap_avx512(R::overflow_bitmap, y) & y_leads)) & y_tail;
+        if (x_bad)
+            return first + __builtin_ctzll(x_bad);
+        if (y_bad)
+            return first + 64 + __builtin_ctzll(y_bad);
+    }
+    return find_invalid_scalar<Alphabet>(first, last);
+}
+
+/*
+ * Power of two bases, b bits a digit: 8 digits are b bytes, a 64 bit lane, 8 b bytes an iteration.
+ */
+template <unsigned b>
+struct pow2_layout
+{
+    /* byte i of lane L: input byte b L + b - 1 - i, the b bytes as a little endian number */
+    static constexpr std::array<uchar_t, 64> gather = []
+    {
+        std::array<uchar_t, 64> x{};
+        for (unsigned j = 0; j < 64; ++j)
+            x[j] = j % 8 < b ? j / 8 * b + b - 1 - j % 8 : 63;
+        return x;
+    }();
+
+    /* digit k of a lane, the most significant first, starts at bit b (7 - k) */
+    static constexpr std::array<uchar_t, 64> shifts = []
+    {
+        std::array<uchar_t, 64> x{};
+        for (unsigned j = 0; j < 64; ++j)
+            x[j] = b * (7 - j % 8);
+        return x;
+    }();
+
+    /* output byte b L + i: byte b - 1 - i of lane L */
+    static constexpr std::array<uchar_t, 64> scatter = []
+    {
+        std::array<uchar_t, 64> x{};
+        for (unsigned j = 0; j < 8 * b; ++j)
+            x[j] = j / b * 8 + b - 1 - j % b;
+        return x;
+    }();
+};
+
+template <class Alphabet> Z85_AVX512
+cursor_t encode_pow2_avx512(cursor_t locs, size_t n) noexcept
+{
+    using R = radix<Alphabet>;
+    using L = pow2_layout<R::bits>;
+    constexpr size_t in = 8 * R::bits, groups = in / R::bytes;
+    static_assert(in % R::bytes == 0, "whole groups an iteration");
+
+    auto const gather = _mm512_loadu_si512(L::gather.data());
+    auto const shifts = _mm512_loadu_si512(L::shifts.data());
+    auto const en_codes = _mm512_loadu_si512(R::en_codes.data());
+    auto const digit = _mm512_set1_epi8(char(R::base - 1));
+
+    for (; n >= groups; n -= groups, locs.first += in, locs.second += 64)
+    {
+        auto const v = _mm512_permutexvar_epi8(gather, _mm512_maskz_loadu_epi8(~0ull >> (64 - in), locs.first));
+        auto const d = _mm512_and_si512(_mm512_multishift_epi64_epi8(shifts, v), digit);
+        _mm512_storeu_si512(locs.second, _mm512_permutexvar_epi8(d, en_codes));
+    }
+    return encode_scalar<Alphabet>(locs, n);
+}
+
+template <class Alphabet> Z85_AVX512
+cursor_t decode_pow2_avx512(cursor_t locs, size_t n) noexcept
+{
+    using R = radix<Alphabet>;
+    using L = pow2_layout<R::bits>;
+    constexpr unsigned b = R::bits;
+    constexpr size_t out = 8 * b, groups = out / R::bytes;
+
+    auto const scatter = _mm512_loadu_si512(L::scatter.data());
+    auto const t0 = _mm512_loadu_si512(R::de_codes.data());
+    auto const t1 = _mm512_loadu_si512(R::de_codes.data() + 64);
+
+    for (; n >= groups; n -= groups, locs.first += 64, locs.second += out)
+    {
+        auto const c = _mm512_loadu_si512(locs.first);
+        auto const d = _mm512_maskz_permutex2var_epi8(~_mm512_movepi8_mask(c), t0, c, t1); // 0 above 0x7f, as de_codes has it
+
+        auto const pairs = _mm512_maddubs_epi16(d, _mm512_set1_epi16(1 << 8 | 1 << b));
+        auto const quads = _mm512_madd_epi16(pairs, _mm512_set1_epi32(1 << 16 | 1 << 2 * b));
+        auto const v = _mm512_or_si512(_mm512_slli_epi64(_mm512_maskz_mov_epi32(0x5555, quads), 4 * b), _mm512_srli_epi64(quads, 32));
+
+        _mm512_mask_storeu_epi8(locs.second, ~0ull >> (64 - out), _mm512_permutexvar_epi8(scatter, v));
+    }
+    return decode_scalar<Alphabet>(locs, n);
+}
+
+template <class Alphabet> Z85_AVX512
+uchar_t const* find_invalid_pow2_avx512(uchar_t const* first, uchar_t const* last) noexcept
+{
+    for (; last - first >= 64; first += 64)
+        if (auto const invalid = ~in_bitmap_avx512(radix<Alphabet>::alphabet_bitmap, _mm512_loadu_si512(first)))
+            return first + __builtin_ctzll(invalid);
+    return find_invalid_scalar<Alphabet>(first, last);
+}
+
+#pragma GCC diagnostic pop
+
+#undef Z85_AVX512
+
+#endif
+
+} // local namespace
+
+/* the best first */
+template <class Alphabet, bool = !!radix<Alphabet>::bits>
+struct bulk_codecs
+{
+    static constexpr bulk_codec list[] = {
+#if defined(__x86_64__) || defined(__i386__)
+        {"avx512vbmi", has_avx512vbmi, encode_avx512<Alphabet>, decode_avx512<Alphabet>, find_invalid_avx512<Alphabet>},
+        {"avx2", has_avx2, encode_avx2<Alphabet>, decode_avx2<Alphabet>, find_invalid_avx2<Alphabet>},
+#endif
+        {"scalar", [] { return true; }, encode_scalar<Alphabet>, decode_scalar<Alphabet>, find_invalid_scalar<Alphabet>},
+    };
+};
+
+template <class Alphabet>
+struct bulk_codecs<Alphabet, true>
+{
+    static constexpr bulk_codec list[] = {
+#if defined(__x86_64__) || defined(__i386__)
+        {"avx512vbmi", has_avx512vbmi, encode_pow2_avx512<Alphabet>, decode_pow2_avx512<Alphabet>, find_invalid_pow2_avx512<Alphabet>},
+#endif
+        {"scalar", [] { return true; }, encode_scalar<Alphabet>, decode_scalar<Alphabet>, find_invalid_scalar<Alphabet>},
+    };
+};
+
+/* picked once, the first one the CPU supports */
+template <class Alphabet = z85_alphabet> inline
+bulk_codec const& bulk() noexcept
+{
+    static bulk_codec const& codec = *std::find_if(std::begin(bulk_codecs<Alphabet>::list), std::end(bulk_codecs<Alphabet>::list),
+            [](bulk_codec const& c) { return c.supported(); });
+    return codec;
+}
+
+template <class Alphabet = z85_alphabet> inline
+cursor_t encode_bulk(cursor_t locs, size_t groups) noexcept { return bulk<Alphabet>().encode(locs, groups); }
+
+template <class Alphabet = z85_alphabet> inline
+cursor_t decode_bulk(cursor_t locs, size_t groups) noexcept { return bulk<Alphabet>().decode(locs, groups); }
+
+/*
+ * Streaming codecs:
+ *   bytes of any length <==> characters, fed in chunks of any size
+ *
+ * The codecs take whole groups only, padding::strict holds to that and fails finish() on
+ * a partial one. padding::partial encodes the last k bytes as the first partial_chars(k) digits of
+ * the group padded with zeros, and decodes them as the group padded with the highest digit,
+ * the same as Ascii85 and unpadded base64 do, so the length need not be sent along.
+ * padding::padded is partial with the group filled up with the pad character of the alphabet
+ * (base64, base32), the decoder takes the pad characters at the end of the stream only.
+ *
+ * The decoder validates: characters out of the alphabet and base 85 groups over 0xffffffff fail it,
+ * error_at() is the offset of the first bad character in the stream.
+ *
+ * A chunk of more than PARALLEL_MIN bytes per thread is split across up to threads threads
+ * on group boundaries, the calling one included.
+ */
+enum class padding { strict, partial, padded };
+
+/* size of the output for a stream of n bytes, the most for n characters */
+template <class Alphabet = z85_alphabet>
+constexpr size_t encoded_size(size_t n, padding pad = padding::partial) noexcept
+{
+    using R = radix<Alphabet>;
+    return n / R::bytes * R::chars + (!(n % R::bytes) ? 0 : pad == padding::padded && R::pad ? R::chars : R::partial_chars(n % R::bytes));
+}
+
+template <class Alphabet = z85_alphabet>
+constexpr size_t decoded_size(size_t n) noexcept
+{
+    using R = radix<Alphabet>;
+    return n / R::chars * R::bytes + R::partial_bytes(n % R::chars);
+}
+
+namespace
+{
+
+size_t const PARALLEL_MIN = 1ul << 20;
+
+/* f(first, last) for the groups [first, last), in up to threads pieces */
+template <class F>
+void for_pieces(size_t groups, size_t group_size, unsigned threads, F&& f)
+{
+    auto const pieces = size_t(std::max(1ul, std::min<size_t>(threads, groups * group_size / PARALLEL_MIN)));
+    auto const step = groups / pieces;
+    std::vector<std::thread> peers;
+    peers.reserve(pieces - 1);
+    for (size_t i = 1; i < pieces; ++i)
+        peers.emplace_back(f, i * step, i + 1 < pieces ? (i + 1) * step : groups);
+    f(size_t(0), step);
+    for (auto& peer : peers)
+        peer.join();
+}
+
+/* a valid group starting with a top digit of base 85 may still be over 0xffffffff */
+template <class Alphabet>
+bool overflows(uchar_t const* group) noexcept
+{
+    using R = radix<Alphabet>;
+    uint64_t val = 0;
+    for (size_t i = 0; i < R::chars; ++i)
+        val = val * R::base + R::de_digits[group[i]];
+    return val >> 8 * R::bytes;
+}
+
+/* decodes whole groups a block at a time, the first bad character or last */
+template <class Alphabet>
+uchar_t const* decode_checked(uchar_t const* first, uchar_t const* last, uchar_t* out) noexcept
+{
+    using R = radix<Alphabet>;
+    size_t const BLOCK = R::chars * 1024; // validated in L1 right before decoding
+
+    auto const& codec = bulk<Alphabet>();
+    while (first != last)
+    {
+        auto const end = first + std::min<size_t>(BLOCK, last - first);
+        for (auto at = codec.find_invalid(first, end); at != end; at = codec.find_invalid(at + R::chars, end))
+        {
+            if (R::de_digits[*at] == INVALID)
+                return at;
+            // a leading top digit, the rest of the group unchecked
+            auto const bad = std::find_if(at + 1, at + R::chars, [](uchar_t c) { return R::de_digits[c] == INVALID; });
+            if (bad != at + R::chars)
+                return bad;
+            if (overflows<Alphabet>(at))
+                return at;
+        }
+
+        out = codec.decode({first, out}, (end - first) / R::chars).second;
+        first = end;
+    }
+    return last;
+}
+
+} // local namespace
+
+template <class Alphabet>
+class basic_encoder
+{
+    using R = radix<Alphabet>;
+
+public:
+    explicit basic_encoder(padding pad = padding::strict, unsigned threads = 1) noexcept: pad_(pad), threads_(threads) {}
+
+    /* encodes all the whole groups so far, carries the rest over, returns the end of the output */
+    uchar_t* update(uchar_t const* first, uchar_t const* last, uchar_t* out)
+    {
+        if (carried_)
+        {
+            while (carried_ < carry_.size() && first != last)
+                carry_[carried_++] = *first++;
+            if (carried_ < carry_.size())
+                return out;
+            out = encode_bulk<Alphabet>({carry_.data(), out}, 1).second;
+            carried_ = 0;
+        }
+
+        auto const groups = size_t(last - first) / R::bytes;
+        for_pieces(groups, R::bytes, threads_, [=](size_t b, size_t e) { encode_bulk<Alphabet>({first + R::bytes * b, out + R::chars * b}, e - b); });
+        first += R::bytes * groups;
+        out += R::chars * groups;
+
+        carried_ = size_t(last - first);
+        std::copy(first, last, carry_.begin());
+        return out;
+    }
+
+    /* the partial group, nullptr if there is one and the padding is strict, then ready for the next stream */
+    uchar_t* finish(uchar_t* out) noexcept
+    {
+        auto const k = carried_;
+        carried_ = 0;
+        if (!k)
+            return out;
+        if (pad_ == padding::strict)
+            return nullptr;
+
+        std::fill(carry_.begin() + k, carry_.end(), 0);
+        std::array<uchar_t, R::chars> group;
+        encode_bulk<Alphabet>({carry_.data(), group.data()}, 1);
+        out = std::copy_n(group.begin(), R::partial_chars(k), out);
+        if (pad_ == padding::padded && R::pad)
+            out = std::fill_n(out, R::chars - R::partial_chars(k), R::pad);
+        return out;
+    }
+
+private:
+    padding const pad_;
+    unsigned const threads_;
+    std::array<uchar_t, R::bytes> carry_;
+    size_t carried_ = 0;
+};
+
+template <class Alphabet>
+class basic_decoder
+{
+    using R = radix<Alphabet>;
+
+public:
+    explicit basic_decoder(padding pad = padding::strict, unsigned threads = 1) noexcept: pad_(pad), threads_(threads) {}
+
+    /* decodes all the whole groups so far, carries the rest over, returns the end of the output or nullptr on bad input */
+    uchar_t* update(uchar_t const* first, uchar_t const* last, uchar_t* out)
+    {
+        if (failed())
+            return nullptr;
+
+        bool const padded = pad_ == padding::padded && R::pad; // the last whole group so far may be the padded one
+        if (carried_)
+        {
+            while (carried_ < carry_.size() && first != last)
+                carry_[carried_++] = *first++;
+            if (carried_ < carry_.size() || (padded && first == last))
+                return out;
+            auto const bad = decode_checked<Alphabet>(carry_.begin(), carry_.end(), out);
+            if (bad != carry_.end())
+                return fail(offset_ + (bad - carry_.begin()));
+            out += R::bytes;
+            offset_ += carried_;
+            carried_ = 0;
+        }
+
+        auto groups = size_t(last - first) / R::chars;
+        if (padded && groups && size_t(last - first) % R::chars == 0)
+            --groups;
+        for_pieces(groups, R::chars, threads_, [&, first, out](size_t b, size_t e)
+        {
+            auto const end = first + R::chars * e;
+            auto const at = decode_checked<Alphabet>(first + R::chars * b, end, out + R::bytes * b);
+            if (at != end)
+                record(at);
+        });
+        if (auto const at = first_bad_.exchange(nullptr))
+            return fail(offset_ + (at - first));
+        first += R::chars * groups;
+        out += R::bytes * groups;
+        offset_ += R::chars * groups;
+
+        carried_ = size_t(last - first);
+        std::copy(first, last, carry_.begin());
+        return out;
+    }
+
+    /* the partial group, nullptr if it is bad or the padding is strict, ready for the next stream unless failed() */
+    uchar_t* finish(uchar_t* out) noexcept
+    {
+        auto k = carried_;
+        carried_ = 0;
+        if (failed())
+            return nullptr;
+        if (!k)
+            return reset(), out;
+
+        if (pad_ == padding::padded && R::pad)
+        {
+            auto const end = carry_.begin() + k;
+            auto const pads = std::find(carry_.begin(), end, R::pad);
+            if (pads != end)
+            {
+                auto const bad = std::find_if(pads, end, [](uchar_t c) { return c != R::pad; });
+                if (bad != end)
+                    return fail(offset_ + (bad - carry_.begin()));
+                if (k != R::chars)
+                    return fail(offset_);
+                k = pads - carry_.begin();
+            }
+            else if (k != R::chars)
+                return fail(offset_);
+        }
+
+        auto const n = R::partial_bytes(k);
+        if (k < R::chars && (pad_ == padding::strict || !n || R::partial_chars(n) != k))
+            return fail(offset_);
+
+        std::fill(carry_.begin() + k, carry_.end(), R::en_codes[R::base - 1]);
+        std::array<uchar_t, R::bytes> group;
+        auto const bad = decode_checked<Alphabet>(carry_.begin(), carry_.end(), group.data());
+        if (bad != carry_.end())
+            return fail(offset_ + std::min<size_t>(bad - carry_.begin(), k - 1));
+        reset();
+        return std::copy_n(group.begin(), k < R::chars ? n : R::bytes, out);
+    }
+
+    bool failed() const noexcept { return error_at_ != NONE; }
+
+    /* offset of the first bad character in the stream */
+    size_t error_at() const noexcept { return error_at_; }
+
+    void reset() noexcept { carried_ = offset_ = 0; error_at_ = NONE; }
+
+private:
+    static constexpr size_t NONE = std::numeric_limits<size_t>::max();
+
+    uchar_t* fail(size_t at) noexcept
+    {
+        error_at_ = at;
+        return nullptr;
+    }
+
+    void record(uchar_t const* at) noexcept
+    {
+        auto seen = first_bad_.load();
+        while ((!seen || at < seen) && !first_bad_.compare_exchange_weak(seen, at));
+    }
+
+    padding const pad_;
+    unsigned const threads_;
+    std::array<uchar_t, R::chars> carry_;
+    size_t carried_ = 0;
+    size_t offset_ = 0; // of the first carried over character in the stream
+    size_t error_at_ = NONE;
+    std::atomic<uchar_t const*> first_bad_ {nullptr};
+};
+
+using encoder = basic_encoder<z85_alphabet>;
+using decoder = basic_decoder<z85_alphabet>;
+
 } // namespace z85
 
 using namespace z85;
@@ -118,8 +1075,116 @@ using namespace z85;
 #include <random>
 #include <chrono>
 #include <functional>
+#include <cassert>
+#include <string>
+
+/* every kernel of the codec bit exact against the scalar one, a streaming round trip per padding, throughput */
+template <class Alphabet>
+void check_codec(char const* name)
+{
+    using R = radix<Alphabet>;
+    using clock = std::chrono::steady_clock;
 
-// g++ -g -Og -std=c++14 -Wall -pedantic -Wno-unused -isystem /path/to/boost/headers z85.cc -o z85
+    std::mt19937 gen(85);
+    std::uniform_int_distribution<uchar_t> dis;
+    size_t const groups = 24 * 1024 / R::bytes + 3;
+    std::vector<uchar_t> samples(groups * R::bytes), encoded(groups * R::chars), decoded(samples.size());
+    std::generate(samples.begin(), samples.end(), std::bind(dis, std::ref(gen)));
+    encode_scalar<Alphabet>({samples.data(), encoded.data()}, groups);
+
+    auto garbage = encoded;
+    for (size_t i = garbage.size() / 2; i < garbage.size(); i += 1 + gen() % 97)
+        garbage[i] = dis(gen);
+    std::vector<uchar_t> expected(decoded.size());
+    decode_scalar<Alphabet>({garbage.data(), expected.data()}, groups);
+
+    for (auto const& codec : bulk_codecs<Alphabet>::list)
+    {
+        if (!codec.supported())
+            continue;
+
+        for (size_t n : {groups, groups - 1, size_t(33), size_t(7), size_t(0)})
+        {
+            std::vector<uchar_t> bulk_encoded(encoded.size()), bulk_decoded(decoded.size());
+            auto const en = codec.encode({samples.data(), bulk_encoded.data()}, n);
+            auto const de = codec.decode({garbage.data(), bulk_decoded.data()}, n);
+            assert(en.first == samples.data() + R::bytes * n && en.second == bulk_encoded.data() + R::chars * n);
+            assert(de.first == garbage.data() + R::chars * n && de.second == bulk_decoded.data() + R::bytes * n);
+            assert(std::equal(encoded.begin(), encoded.begin() + R::chars * n, bulk_encoded.begin()));
+            assert(std::equal(expected.begin(), expected.begin() + R::bytes * n, bulk_decoded.begin()));
+            assert(std::all_of(bulk_encoded.begin() + R::chars * n, bulk_encoded.end(), [](uchar_t c) { return !c; }));
+            assert(std::all_of(bulk_decoded.begin() + R::bytes * n, bulk_decoded.end(), [](uchar_t c) { return !c; }));
+        }
+
+        for (auto at = garbage.data(), end = garbage.data() + garbage.size(); at != end;)
+        {
+            auto const bad = codec.find_invalid(at, end);
+            assert(bad == find_invalid_scalar<Alphabet>(at, end));
+            at = std::min(at + (bad - at) / R::chars * R::chars + R::chars, end);
+        }
+
+        auto const iterations = 2000;
+        auto const started = clock::now();
+        for (int i = 0; i < iterations; ++i) codec.encode({samples.data(), encoded.data()}, groups);
+        auto const encoded_at = clock::now();
+        for (int i = 0; i < iterations; ++i) codec.decode({encoded.data(), decoded.data()}, groups);
+        auto const decoded_at = clock::now();
+        assert(decoded == samples);
+
+        auto const encoder_usec = std::max(std::chrono::duration_cast<std::chrono::microseconds>(encoded_at - started).count(), 1l);
+        auto const decoder_usec = std::max(std::chrono::duration_cast<std::chrono::microseconds>(decoded_at - encoded_at).count(), 1l);
+        std::cout << name << " (bulk, " << codec.isa << "): encoder " << std::dec << (samples.size() * iterations / encoder_usec)
+                << " bytes/us, decoder " << (samples.size() * iterations / decoder_usec) << " bytes/us \n";
+    }
+
+    for (auto pad : {padding::strict, padding::partial, padding::padded})
+    {
+        for (size_t n = 0; n <= 2 * R::bytes; ++n)
+        {
+            if (pad == padding::strict && n % R::bytes)
+                continue;
+            std::vector<uchar_t> text(encoded_size<Alphabet>(n, pad) + 1, 0), back(n + 1, 0);
+
+            basic_encoder<Alphabet> en(pad);
+            auto const end = en.finish(en.update(samples.data(), samples.data() + n, text.data()));
+            assert(end == text.data() + encoded_size<Alphabet>(n, pad));
+
+            basic_decoder<Alphabet> de(pad);
+            auto out = back.data();
+            for (auto at = text.data(); at != end; ++at)
+                out = de.update(at, at + 1, out);
+            out = de.finish(out);
+            assert(out == back.data() + n && std::equal(back.begin(), back.begin() + n, samples.begin()));
+        }
+    }
+}
+
+/* the whole stream through the codec */
+template <class Alphabet>
+std::string encoded_as(std::string const& text, padding pad = padding::padded)
+{
+    std::string out(encoded_size<Alphabet>(text.size(), pad), 0);
+    basic_encoder<Alphabet> en(pad);
+    auto const first = (uchar_t const*)text.data();
+    auto const end = en.finish(en.update(first, first + text.size(), (uchar_t*)&out[0]));
+    assert(end == (uchar_t*)&out[0] + out.size());
+    return out;
+}
+
+template <class Alphabet>
+std::string decoded_as(std::string const& text, padding pad = padding::padded)
+{
+    std::string out(decoded_size<Alphabet>(text.size()), 0);
+    basic_decoder<Alphabet> de(pad);
+    auto const first = (uchar_t const*)text.data();
+    auto const end = de.finish(de.update(first, first + text.size(), (uchar_t*)&out[0]));
+    if (!end)
+        return "<" + std::to_string(de.error_at()) + ">";
+    out.resize(end - (uchar_t*)&out[0]);
+    return out;
+}
+
+// g++ -g -O2 -std=c++17 -Wall -pedantic -Wno-unused -pthread z85.cc -o z85
 int main()
 {
     std::array<uchar_t, 8> const sample {0x86, 0x4F, 0xD2, 0x6F, 0xB5, 0x59, 0xF7, 0x5B};
@@ -196,6 +1261,121 @@ int main()
         auto decoder_usec = std::chrono::duration_cast<std::chrono::microseconds>(decoder_stopped - decoder_started);
         std::cout << "encoder: " << std::dec << encoder_usec.count() << " us, " << ((samples.size() * iterations) / encoder_usec.count()) << " bytes/us \n";
         std::cout << "decoder: " << std::dec << decoder_usec.count() << " us, " << ((samples.size() * iterations) / decoder_usec.count()) << " bytes/us \n";
+
+        std::cout << "bulk codec: " << bulk().isa << std::endl;
+    }
+
+    {
+        // streaming: random chunks, partial padding, round trip
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<uchar_t> dis;
+        std::vector<uchar_t> samples(10007), encoded(encoded_size(samples.size())), decoded(samples.size());
+        std::generate(samples.begin(), samples.end(), std::bind(dis, std::ref(gen)));
+
+        auto chunk = [&gen](size_t left) { return std::min<size_t>(left, std::uniform_int_distribution<size_t>(0, 700)(gen)); };
+
+        encoder en(padding::partial);
+        auto out = encoded.data();
+        for (size_t i = 0, n = 0; i < samples.size(); i += n)
+            out = en.update(samples.data() + i, samples.data() + i + (n = chunk(samples.size() - i)), out);
+        out = en.finish(out);
+        assert(out == encoded.data() + encoded.size());
+
+        std::vector<uchar_t> whole(encoded.size());
+        encode_bulk({samples.data(), whole.data()}, samples.size() / 4);
+        assert(std::equal(whole.begin(), whole.end() - 4, encoded.begin()));
+
+        decoder de(padding::partial);
+        auto back = decoded.data();
+        for (size_t i = 0, n = 0; i < encoded.size(); i += n)
+            back = de.update(encoded.data() + i, encoded.data() + i + (n = chunk(encoded.size() - i)), back);
+        back = de.finish(back);
+        assert(back == decoded.data() + decoded.size() && decoded == samples);
+
+        // strict padding, validation
+        encoder strict;
+        assert(strict.finish(strict.update(samples.data(), samples.data() + 7, encoded.data())) == nullptr);
+
+        decoder check;
+        assert(!check.finish(check.update(encoded.data(), encoded.data() + 12, decoded.data())) && check.error_at() == 10);
+
+        for (size_t at : {size_t(3), size_t(4999), size_t(5000), size_t(9000)})
+        {
+            auto const good = encoded[at];
+            encoded[at] = '~';
+            check.reset();
+            assert(!check.update(encoded.data(), encoded.data() + 10000, decoded.data()) && check.error_at() == at);
+            encoded[at] = good;
+        }
+
+        uchar_t const too_big[] = "%nSc1";
+        check.reset();
+        assert(!check.update(too_big, too_big + 5, decoded.data()) && check.error_at() == 0);
+        uchar_t const max[] = "%nSc0";
+        check.reset();
+        assert(check.update(max, max + 5, decoded.data()) && std::all_of(decoded.begin(), decoded.begin() + 4, [](uchar_t c) { return c == 0xff; }));
+
+        // parallel, multi-megabyte
+        auto const threads = std::max(2u, std::thread::hardware_concurrency());
+        samples.resize(64ul << 20);
+        std::generate(samples.begin(), samples.end(), std::bind(dis, std::ref(gen)));
+        encoded.assign(encoded_size(samples.size()), 0);
+        decoded.assign(samples.size(), 0);
+
+        using clock = std::chrono::steady_clock;
+        for (unsigned t : {1u, threads})
+        {
+            auto const started = clock::now();
+            encoder en(padding::strict, t);
+            assert(en.finish(en.update(samples.data(), samples.data() + samples.size(), encoded.data())) == encoded.data() + encoded.size());
+            auto const encoded_at = clock::now();
+            decoder de(padding::strict, t);
+            assert(de.finish(de.update(encoded.data(), encoded.data() + encoded.size(), decoded.data())) == decoded.data() + decoded.size());
+            auto const decoded_at = clock::now();
+            assert(decoded == samples);
+
+            auto const encoder_usec = std::chrono::duration_cast<std::chrono::microseconds>(encoded_at - started).count();
+            auto const decoder_usec = std::chrono::duration_cast<std::chrono::microseconds>(decoded_at - encoded_at).count();
+            std::cout << "stream encoder (" << t << " threads): " << (samples.size() / std::max(encoder_usec, 1l)) << " bytes/us \n";
+            std::cout << "stream decoder (" << t << " threads, validating): " << (samples.size() / std::max(decoder_usec, 1l)) << " bytes/us \n";
+        }
+    }
+
+    {
+        // the codec family, known vectors (RFC 4648, the Adobe Ascii85 and ZMQ RFC 32 examples)
+        assert(encoded_as<z85_alphabet>("\x86\x4f\xd2\x6f\xb5\x59\xf7\x5b") == "HelloWorld");
+        assert(encoded_as<ascii85_alphabet>("Man is", padding::partial) == "9jqo^Bla");
+        assert(encoded_as<ascii85_alphabet>("foobar", padding::partial) == "AoDTs@<)");
+        assert(decoded_as<ascii85_alphabet>("9jqo^Bla", padding::partial) == "Man is");
+        assert(encoded_as<base64_alphabet>("foobar") == "Zm9vYmFy");
+        assert(encoded_as<base64_alphabet>("fooba") == "Zm9vYmE=");
+        assert(encoded_as<base64_alphabet>("foob") == "Zm9vYg==");
+        assert(encoded_as<base64_alphabet>("fooba", padding::partial) == "Zm9vYmE");
+        assert(encoded_as<base64_alphabet>("\xfb\xff\xfe") == "+//+");
+        assert(encoded_as<base64url_alphabet>("\xfb\xff\xfe") == "-__-");
+        assert(encoded_as<base32_alphabet>("foobar") == "MZXW6YTBOI======");
+        assert(encoded_as<base32_alphabet>("fooba") == "MZXW6YTB");
+        assert(encoded_as<hex_alphabet>("foobar") == "666f6f626172");
+
+        assert(decoded_as<base64_alphabet>("Zm9vYmE=") == "fooba");
+        assert(decoded_as<base64_alphabet>("Zm9vYg==") == "foob");
+        assert(decoded_as<base64_alphabet>("Zm9vYmE", padding::partial) == "fooba");
+        assert(decoded_as<base32_alphabet>("MZXW6YTBOI======") == "foobar");
+        assert(decoded_as<hex_alphabet>("666f6f626172") == "foobar");
+        assert(decoded_as<base64_alphabet>("Zm9vYmE") == "<4>"); // a pad short
+        assert(decoded_as<base64_alphabet>("Zm9v=mE=") == "<5>"); // pad in the middle of the stream
+        assert(decoded_as<base64_alphabet>("Zm9vY===") == "<4>"); // 6 bits are not a byte
+        assert(decoded_as<base64_alphabet>("Zm9v====") == "<4>");
+        assert(decoded_as<base64_alphabet>("Zm9vYm=E") == "<7>");
+        assert(decoded_as<hex_alphabet>("666f6f62617") == "<10>");
+        assert(decoded_as<hex_alphabet>("666F6f626172") == "<3>");
+
+        check_codec<z85_alphabet>("z85");
+        check_codec<ascii85_alphabet>("ascii85");
+        check_codec<base64_alphabet>("base64");
+        check_codec<base64url_alphabet>("base64url");
+        check_codec<base32_alphabet>("base32");
+        check_codec<hex_alphabet>("hex");
     }
 
     return 0;